@@ -105,8 +105,8 @@ u64 estimate_cardinality(const std::vector<std::string> &paths,
 }
 
 int classify_main(int argc, char *argv[]) {
-    int co, num_threads(1), emit_kraken(1), emit_fastq(0), emit_all(0), chunk_size(1 << 20), per_set(32);
-    bool canonicalize(true);
+    int co, num_threads(1), emit_kraken(1), emit_fastq(0), emit_all(0), chunk_size(1 << 20), per_set(32), dust_level(0), min_quality(0);
+    bool canonicalize(true), hpc(false);
     std::ios_base::sync_with_stdio(false);
     std::FILE *ofp(stdout);
     if(argc < 4) {
@@ -120,23 +120,29 @@ int classify_main(int argc, char *argv[]) {
                              "-K:\tDo not emit kraken-style output.\n"
                              "-f:\tEmit fastq-style output.\n"
                              "-K:\tDo not emit fastq-formatted output.\n"
+                             "-d:\tSkip low-complexity k-mers with a DUST score above this level (e.g., 20). Default: off\n"
+                             "-q:\tSkip k-mers containing bases with Phred quality below this in FASTQ input. Default: off\n"
+                             "-P:\tHomopolymer-compress reads before extracting k-mers. Use for databases built with -P.\n"
                              "\nIf -f and -k are set, full kraken output will be contained in the fastq comment field."
                              "\n  Default: kraken-style only output.\n",
                  *argv, 1 << 14);
         std::exit(EXIT_FAILURE);
     }
-    while((co = getopt(argc, argv, "Cc:p:o:S:afFkKh?")) >= 0) {
+    while((co = getopt(argc, argv, "Cc:d:p:o:q:S:afFkKPh?")) >= 0) {
         switch(co) {
             case 'h': case '?': goto usage;
             case 'C': canonicalize = false; break;
             case 'a': emit_all = 1; break;
             case 'c': chunk_size = std::atoi(optarg); break;
+            case 'd': dust_level = std::atoi(optarg); break;
             case 'F': emit_fastq  = 0; break;
             case 'f': emit_fastq  = 1; break;
             case 'K': emit_kraken = 0; break;
             case 'k': emit_kraken = 1; break;
             case 'p': num_threads = std::atoi(optarg); break;
+            case 'P': hpc = true; break;
             case 'o': ofp = std::fopen(optarg, "w"); break;
+            case 'q': min_quality = std::atoi(optarg); break;
             case 'S': per_set = std::atoi(optarg); break;
         }
     }
@@ -147,10 +153,16 @@ int classify_main(int argc, char *argv[]) {
         case 4:  LOG_DEBUG("Processing in paired-end mode.\n"); break;
     }
     Database<khash_t(c)> db(argv[optind]);
+    if(db.alphabet_ != DNA) LOG_EXIT("This database holds non-DNA k-mers, but classify encodes reads as DNA.\n");
+    if((dust_level > 0 || hpc) && std::any_of(db.s_.begin(), db.s_.end(), [](auto x) {return x != 0;}))
+        LOG_EXIT("-d and -P require a contiguous seed, but this database was built with a spaced seed.\n");
     //reportDB<khash_t(c)>(&db, stderr);
     //for(auto &i: db._s) --i; // subtract by one since we'll re-subtract during construction.
     ClassifierGeneric<score::Lex> c(db.db_, db.s_, db.k_, db.k_, num_threads,
                                    emit_all, emit_fastq, emit_kraken, canonicalize);
+    if(dust_level > 0) c.set_dust(dust_level);
+    if(min_quality > 0) c.set_min_quality(min_quality);
+    if(hpc) c.set_homopolymer_compress(true);
     khash_t(p) *taxmap(build_parent_map(argv[optind + 1]));
     // We can use optind + 3 for both single-end and paired-end mode since the argument at
     // index argc is null when argc - optind == 3.
@@ -167,8 +179,8 @@ bool endswith(const std::string &path, const std::string &suf) {
 }
 
 int phase2_main(int argc, char *argv[]) {
-    int c, mode(score_scheme::LEX), wsz(-1), num_threads(1), k(31);
-    bool canon(true);
+    int c, mode(score_scheme::LEX), wsz(-1), num_threads(1), k(31), dust_level(0);
+    bool canon(true), hpc(false);
     WRITE write_fmt = UNCOMPRESSED;
     std::size_t start_size(1<<16);
     std::string spacing, tax_path, seq2taxpath, paths_file;
@@ -190,10 +202,12 @@ int phase2_main(int argc, char *argv[]) {
                      "-M: Set seq2taxpath.\n"
                      "-S: Set spacing.\n"
                      "-z: Write gzip-compressed.\n"
+                     "-P: Homopolymer-compress sequences before extracting k-mers (classify with -P as well).\n"
+                     "-d: Skip low-complexity k-mers with a DUST score above this level (e.g., 20). Default: off\n"
                      , *argv);
         std::exit(EXIT_FAILURE);
     }
-    while((c = getopt(argc, argv, "Cw:M:S:p:k:T:F:tefHh?")) >= 0) {
+    while((c = getopt(argc, argv, "Cd:w:M:S:p:k:T:F:tefHPh?")) >= 0) {
         switch(c) {
             case 'C': canon = false; break;
             case 'h': case '?': goto usage;
@@ -207,10 +221,16 @@ int phase2_main(int argc, char *argv[]) {
             case 'T': tax_path = optarg; break;
             case 'M': seq2taxpath = optarg; break;
             case 'F': paths_file = optarg; break;
+            case 'P': hpc = true; break;
+            case 'd': dust_level = std::atoi(optarg); break;
             case 'e': mode = score_scheme::ENTROPY; break;
             case 'z': write_fmt = ZLIB; break;
         }
     }
+    if((dust_level || hpc) && mode == score_scheme::ENTROPY) {
+        std::fprintf(stderr, "-d and -P cannot be combined with -e: DUST and homopolymer compression require lexicographic minimizers.\n");
+        goto usage;
+    }
     dbpath = argv[optind];
     if(num_threads < 0) num_threads = std::thread::hardware_concurrency();
     if(wsz < k) wsz = k;
@@ -224,6 +244,8 @@ int phase2_main(int argc, char *argv[]) {
         dbpath += suf, LOG_INFO("Writing gzipped, but without a .gz suffix. Adding it.\n");
     LOG_INFO("db output path: %s\n", dbpath.data());
     spvec_t sv(parse_spacing(spacing.data(), k));
+    if((dust_level || hpc) && std::any_of(sv.begin(), sv.end(), [](auto x) {return x != 0;}))
+        LOG_EXIT("-d and -P require a contiguous seed and cannot be combined with a spaced seed (-S).\n");
     std::vector<std::string> inpaths(paths_file.size() ? get_paths(paths_file.data())
                                                        : std::vector<std::string>(argv + optind + 2, argv + argc));
     if(inpaths.empty()) LOG_EXIT("Need input files from command line or file. See usage.\n");
@@ -257,8 +279,8 @@ int phase2_main(int argc, char *argv[]) {
         khash_t(p) *taxmap(build_parent_map(tax_path.data()));
         //LOG_INFO("I just feel like stopping this executable now for testing.\n");
         //goto fail;
-        phase2_map.db_ = score_scheme::LEX == mode ? lca_map<score::Lex>(inpaths, taxmap, seq2taxpath.data(), sp, num_threads, canon, hash_size)
-                                                   : lca_map<score::Entropy>(inpaths, taxmap, seq2taxpath.data(), sp, num_threads, canon, hash_size);
+        phase2_map.db_ = score_scheme::LEX == mode ? lca_map<score::Lex>(inpaths, taxmap, seq2taxpath.data(), sp, num_threads, canon, hash_size, hpc, dust_level)
+                                                   : lca_map<score::Entropy>(inpaths, taxmap, seq2taxpath.data(), sp, num_threads, canon, hash_size, hpc, dust_level);
         phase2_map.write(dbpath.data(), write_fmt);
         //fail:
         kh_destroy(p, taxmap);
@@ -269,7 +291,7 @@ int phase2_main(int argc, char *argv[]) {
     Database<khash_t(c)>  phase2_map{phase1_map};
     Spacer sp(k, wsz, phase1_map.s_);
     khash_t(p) *taxmap(tax_path.empty() ? nullptr: build_parent_map(tax_path.data()));
-    phase2_map.db_ = minimized_map<score::Hash>(inpaths, phase1_map.db_, seq2taxpath.data(), taxmap, sp, num_threads, start_size, canon);
+    phase2_map.db_ = minimized_map<score::Hash>(inpaths, phase1_map.db_, seq2taxpath.data(), taxmap, sp, num_threads, start_size, canon, hpc, dust_level);
     std::string dbpath2 = argv[optind + 1];
     if(endswith(dbpath2, suf))     write_fmt = ZLIB;
     if(write_fmt && !endswith(dbpath2, ".gz"))
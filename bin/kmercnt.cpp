@@ -13,23 +13,40 @@ using namespace bns;
 #define VALUE_TYPE uint32_t
 #endif
 using CType = ska::flat_hash_map<uint64_t, VALUE_TYPE>;
+// Exact k-mers for 32 < k <= 64, keyed on packed 16-byte k-mers
+using CType128 = ska::flat_hash_map<Kmer128, VALUE_TYPE, Kmer128Hash>;
 
-void update_kmerc(CType &kmerc, const std::string &path, int k, bool canon, const int htype, kseq_t *kseq=static_cast<kseq_t*>(nullptr), RollingHashingType rht=RollingHashingType::DNA) {
-    Encoder<> enc(k, canon);
-    RollingHasher<uint64_t> rolling_hasher(k, canon, rht);
-    auto update_fn = [&kmerc](uint64_t x) {
-        auto it = kmerc.find(x);
-        if(it == kmerc.end()) kmerc.emplace(x, 1u);
-        else ++it->second;
+template<typename MapType>
+void update_kmerc(MapType &kmerc, const std::string &path, int k, bool canon, const int htype, kseq_t *kseq=static_cast<kseq_t*>(nullptr), RollingHashingType rht=RollingHashingType::DNA, double scale=1., unsigned minq=0) {
+    using KeyType = typename MapType::key_type;
+    auto update_fn = [&kmerc](auto kmers) {
+        for(const auto x: kmers) {
+            auto it = kmerc.find(KeyType(x));
+            if(it == kmerc.end()) kmerc.emplace(KeyType(x), 1u);
+            else ++it->second;
+        }
     };
-    if(htype == 0) {
-        enc.for_each(update_fn, path.data(), kseq);
-    } else if(htype == 1) {
-        rolling_hasher.for_each_hash(update_fn, path.data(), kseq);
-    } else if(htype == 2) {
-        enc.for_each_hash(update_fn, path.data(), kseq);
+    if constexpr(std::is_same<KeyType, Kmer128>::value) {
+        Encoder<score::Lex, u128> enc(k, canon);
+        enc.scaled(scale);
+        enc.min_quality(minq);
+        enc.for_each_batch(update_fn, path.data(), kseq);
     } else {
-        std::fprintf(stderr, "Warning: this should never happen\n");
+        Encoder<> enc(k, canon);
+        RollingHasher<uint64_t> rolling_hasher(k, canon, rht);
+        enc.scaled(scale);
+        rolling_hasher.scaled(scale);
+        enc.min_quality(minq);
+        rolling_hasher.min_quality(minq);
+        if(htype == 0) {
+            enc.for_each_batch(update_fn, path.data(), kseq);
+        } else if(htype == 1) {
+            rolling_hasher.for_each_batch(update_fn, path.data(), kseq);
+        } else if(htype == 2) {
+            enc.for_each_hash_batch(update_fn, path.data(), kseq);
+        } else {
+            std::fprintf(stderr, "Warning: this should never happen\n");
+        }
     }
 }
 
@@ -61,52 +78,20 @@ void usage() {
                         "-P: Parse protein k-mers instead of DNA k-mers\n"
                         "-B: emit binary (sparse vector) notation\n"
                         "-b: emit binary stream of [uint64_t, uint64_t] k-mer/count pairs\n"
+                        "    For 32 < k <= 64, k-mers are counted exactly as 128-bit integers: -B emits 16-byte k-mers (low word first)\n"
+                        "    and -b emits [uint64_t, uint64_t, uint64_t] (k-mer low word, k-mer high word, count) triples.\n"
+                        "-q: skip k-mers containing bases with Phred quality below <q> in FASTQ input [0: off]\n"
+                        "-x: only count k-mers in a FracMinHash sample of 1/<scale> (hash <= 2^64 / scale) [1: all k-mers]\n"
         );
 }
 
-int main(int argc, char **argv) {
-    std::string ofile = "/dev/stdout", fpaths;
-    std::string kmerparsetype = "bns";
-    bool canon = true, sort_by_hash = false, enable_protein = false;
-    int binary_output = false;
-    int k = 31, nthreads = 1;
-    for(int c;(c = getopt(argc, argv, "k:F:o:p:bBcCNh?")) >= 0;) {
-        switch(c) {
-            case 'k': k = std::atoi(optarg); break;
-            case 'o': ofile = optarg; break;
-            case 'h': usage(); return EXIT_FAILURE;
-            case 'N': kmerparsetype = "nthash"; break;
-            case 'C': canon = false; break;
-            case 'c': kmerparsetype = "cyclic"; break;
-            case 'F': fpaths = optarg; break;
-            case 'p': nthreads = std::atoi(optarg); break;
-            case 'S': sort_by_hash = true; break;
-            case 'P': enable_protein = true; kmerparsetype = "cyclic"; break;
-            case 'B': binary_output = true; break;
-            case 'b': binary_output = 2; break;
-            //case 'S': spacestr = optarg; break;
-        }
-    }
-    std::vector<std::string> infiles(argv + optind, argv + argc);
-    if(fpaths.size()) {
-        std::ifstream ifs(fpaths);
-        for(std::string line;std::getline(ifs, line);) {
-            infiles.emplace_back(line);
-        }
-    }
-    if(infiles.empty()) {
-        infiles.emplace_back("/dev/stdin");
-    }
-    if(k > 32 && kmerparsetype == "bns") {
-        kmerparsetype = "cyclic";
-    }
-    nthreads = std::max(nthreads, 1);
-#ifdef _OPENMP
-    omp_set_num_threads(nthreads);
-#endif
-    std::fprintf(stderr, "Counting %s %u-mers, %s\n", canon ? "canonical": "stranded", k, &kmerparsetype[0]);
+template<typename MapType>
+void count_kmers(const std::vector<std::string> &infiles, const std::string &ofile, int k, bool canon, int htype, int nthreads,
+                 bool sort_by_hash, int binary_output, RollingHashingType rht, double scale, unsigned minq) {
+    using KeyType = typename MapType::key_type;
+    static constexpr bool is128 = std::is_same<KeyType, Kmer128>::value;
     std::vector<kseq_t> kseqs;
-    std::vector<CType> threadkmercs(nthreads);
+    std::vector<MapType> threadkmercs(nthreads);
     for(auto &kmerc: threadkmercs) kmerc.reserve(1<<22); // reserve 4MB to start
     while(std::ptrdiff_t(kseqs.size()) < nthreads) kseqs.emplace_back(kseq_init_stack());
     const size_t initsize = 1ull << 22;
@@ -114,7 +99,6 @@ int main(int argc, char **argv) {
         ks.seq.m = initsize;
         ks.seq.s = static_cast<char *>(std::malloc(initsize));
     }
-    const int htype = kmerparsetype == "bns" ? 0: kmerparsetype == "cyclic"? 1: 2;
 #ifdef _OPENMP
     #pragma omp parallel for schedule(dynamic)
 #endif
@@ -125,17 +109,17 @@ int main(int argc, char **argv) {
         tid = omp_get_thread_num();
 #endif
         assert(tid < threadkmercs.size());
-        update_kmerc(threadkmercs.at(tid), infiles[i], k, canon, htype, &kseqs[tid], enable_protein ? bns::RollingHashingType::PROTEIN: RollingHashingType::DNA);
+        update_kmerc(threadkmercs.at(tid), infiles[i], k, canon, htype, &kseqs[tid], rht, scale, minq);
     }
     auto &kmerc = threadkmercs.front();
-    par_reduce(threadkmercs.data(), threadkmercs.size(), [](CType &lhs, const CType &rhs) {
+    par_reduce(threadkmercs.data(), threadkmercs.size(), [](MapType &lhs, const MapType &rhs) {
         for(const auto &pair: rhs) {
             auto it = lhs.find(pair.first);
             if(it != lhs.end()) it->second += pair.second;
             else lhs.emplace(pair);
         }
     });
-    std::vector<std::pair<uint64_t, VALUE_TYPE>> res(kmerc.size());
+    std::vector<std::pair<KeyType, VALUE_TYPE>> res(kmerc.size());
     std::copy(kmerc.begin(), kmerc.end(), res.begin());
     std::ios_base::sync_with_stdio(false);
     const auto maxc = std::max_element(res.begin(), res.end(), [](auto x, auto y) {return x.second < y.second;})->second;
@@ -151,11 +135,11 @@ int main(int argc, char **argv) {
         std::FILE *ofb = std::fopen((ofile + "hash").data(), "wb");
         std::FILE *ofc = std::fopen((ofile + "count").data(), "wb");
         for(const auto &pair: res) {
-            uint64_t h = pair.first;
+            uint64_t h;
             uint32_t uv;
             uint16_t us;
             uint8_t ub;
-            std::fwrite(&h, 1, sizeof(h), ofb);
+            std::fwrite(&pair.first, 1, sizeof(pair.first), ofb);
             if constexpr(sizeof(VALUE_TYPE) > 4) {
                 if(maxc > 0xFFFFFFFFull) {h = pair.second;std::fwrite(&h, 1, sizeof(h), ofc);}
             }
@@ -166,17 +150,75 @@ int main(int argc, char **argv) {
         std::fclose(ofc); std::fclose(ofb);
     } else if(binary_output == 2) {
         std::FILE *ofp = std::fopen(ofile.data(), "wb");
-        uint64_t x[2];
         for(const auto &pair: res) {
-            x[0] = pair.first, x[1] = pair.second;
-            std::fwrite(x, 1, sizeof(x), ofp);
+            if constexpr(is128) {
+                const uint64_t x[3]{pair.first.lo_, pair.first.hi_, uint64_t(pair.second)};
+                std::fwrite(x, 1, sizeof(x), ofp);
+            } else {
+                const uint64_t x[2]{pair.first, uint64_t(pair.second)};
+                std::fwrite(x, 1, sizeof(x), ofp);
+            }
         }
         std::fclose(ofp);
     } else {
         std::ofstream ofs(ofile);
         ofs << "ID\tCount\n";
         for(const auto &pair: res) {
-            ofs << pair.first << '\t' << pair.second << '\n';
+            if constexpr(is128) ofs << to_string(u128(pair.first)) << '\t' << pair.second << '\n';
+            else                ofs << pair.first << '\t' << pair.second << '\n';
         }
     }
 }
+
+int main(int argc, char **argv) {
+    std::string ofile = "/dev/stdout", fpaths;
+    std::string kmerparsetype = "bns";
+    bool canon = true, sort_by_hash = false, enable_protein = false;
+    int binary_output = false;
+    int k = 31, nthreads = 1;
+    double scale = 1.;
+    unsigned minq = 0;
+    for(int c;(c = getopt(argc, argv, "k:F:o:p:q:x:bBcCNSh?")) >= 0;) {
+        switch(c) {
+            case 'k': k = std::atoi(optarg); break;
+            case 'o': ofile = optarg; break;
+            case 'h': usage(); return EXIT_FAILURE;
+            case 'N': kmerparsetype = "nthash"; break;
+            case 'C': canon = false; break;
+            case 'c': kmerparsetype = "cyclic"; break;
+            case 'F': fpaths = optarg; break;
+            case 'p': nthreads = std::atoi(optarg); break;
+            case 'S': sort_by_hash = true; break;
+            case 'P': enable_protein = true; kmerparsetype = "cyclic"; break;
+            case 'B': binary_output = true; break;
+            case 'b': binary_output = 2; break;
+            case 'x': scale = std::atof(optarg); break;
+            case 'q': minq = std::atoi(optarg); break;
+            //case 'S': spacestr = optarg; break;
+        }
+    }
+    std::vector<std::string> infiles(argv + optind, argv + argc);
+    if(fpaths.size()) {
+        std::ifstream ifs(fpaths);
+        for(std::string line;std::getline(ifs, line);) {
+            infiles.emplace_back(line);
+        }
+    }
+    if(infiles.empty()) {
+        infiles.emplace_back("/dev/stdin");
+    }
+    if(k > 64 && kmerparsetype == "bns") {
+        kmerparsetype = "cyclic";
+    }
+    nthreads = std::max(nthreads, 1);
+#ifdef _OPENMP
+    omp_set_num_threads(nthreads);
+#endif
+    std::fprintf(stderr, "Counting %s %u-mers, %s%s\n", canon ? "canonical": "stranded", k, &kmerparsetype[0], k > 32 && kmerparsetype == "bns" ? " (exact, 128-bit)": "");
+    const int htype = kmerparsetype == "bns" ? 0: kmerparsetype == "cyclic"? 1: 2;
+    const RollingHashingType rht = enable_protein ? RollingHashingType::PROTEIN: RollingHashingType::DNA;
+    if(k > 32 && htype == 0)
+        count_kmers<CType128>(infiles, ofile, k, canon, htype, nthreads, sort_by_hash, binary_output, rht, scale, minq);
+    else
+        count_kmers<CType>(infiles, ofile, k, canon, htype, nthreads, sort_by_hash, binary_output, rht, scale, minq);
+}
@@ -7,13 +7,15 @@
 void usage() {
     std::fprintf(stderr, "rolling_multk_sketch <opts> in.fa\n-P: set prefix\n-p: set number of threads\n-k: Add kmer length\n-C: Do not canonicalize\n-r:  set START,END for kmer range (e.g., -r34,38 will use 34, 35, 36, 37]).\n");
     std::fprintf(stderr, "-S: set log 2 sketch size (14)\n");
+    std::fprintf(stderr, "-x: only sketch k-mers in a FracMinHash sample of 1/<scale> (hash <= 2^64 / scale) [1: all k-mers]\n");
     std::exit(1);
 }
 
 template<typename Sketch=sketch::hll_t, typename C, typename IT=uint64_t, typename ArgType, typename ... Args>
-std::vector<Sketch> build_multk_sketches(const C &kmer_sizes, ArgType fp, bool canon=false, Args &&... args) {
+std::vector<Sketch> build_multk_sketches(const C &kmer_sizes, ArgType fp, bool canon=false, double scale=1., Args &&... args) {
     static_assert(std::is_same<ArgType, gzFile>::value  || std::is_same<ArgType, char *>::value || std::is_same<ArgType, const char *>::value, "Must be gzFile, char *, or const char *");
-    bns::RollingHasherSet<IT> rhs(kmer_sizes, canon);
+    bns::MultiKHasher<IT> rhs(kmer_sizes, canon);
+    rhs.scaled(scale);
     const size_t nsk = kmer_sizes.size();
     std::vector<Sketch> sketches;
     sketches.reserve(nsk);
@@ -29,14 +31,16 @@ int main(int argc, char *argv[]) {
     std::string prefix;
     int canon = true;
     size_t l2sz = 14;
+    double scale = 1.;
     std::vector<uint32_t> ks;
-    while((c = getopt(argc, argv, "ChP:p:k:r:S:")) >= 0) {
+    while((c = getopt(argc, argv, "ChP:p:k:r:S:x:")) >= 0) {
         switch(c) {
             case 'h': usage(); break;
             case 'k': {auto i = std::atoi(optarg); if(i > 0) ks.push_back(i);} break;
             case 'C': canon = false; break;
             case 'P': prefix = optarg; break;
             case 'S': l2sz = std::atoi(optarg); break;
+            case 'x': scale = std::atof(optarg); break;
             case 'p': omp_set_num_threads(std::atoi(optarg)); break;
             case 'r':
                 {
@@ -53,7 +57,7 @@ int main(int argc, char *argv[]) {
     if(optind == argc) usage();
     if(prefix.empty()) prefix = argv[optind];
     gzFile fp = gzopen(argv[optind], "rb");
-    auto sketches = build_multk_sketches(ks, fp, canon, l2sz);
+    auto sketches = build_multk_sketches(ks, fp, canon, scale, l2sz);
     for(const auto &s: sketches) {
         auto path = prefix + "." + std::to_string(ks[&s - &*sketches.begin()]) + ".sketch." + std::to_string(l2sz) + ".hll";
         LOG_DEBUG("Writing to path %s\n", path.data());
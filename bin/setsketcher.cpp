@@ -14,17 +14,23 @@ using namespace bns;
 #define CSETFT double
 #endif
 
-template<typename Sketch>
-void update_sketch(Encoder<> &enc, RollingHasher<uint64_t> &rolling_hasher, Sketch &sketch, const std::string &path, const int htype, kseq_t *kseq=static_cast<kseq_t*>(nullptr)) {
-    auto update_fn = [&sketch](uint64_t x) {
-        sketch.update(x);
+template<typename Sketch, typename EncoderType>
+void update_sketch(EncoderType &enc, RollingHasher<uint64_t> &rolling_hasher, Sketch &sketch, const std::string &path, const int htype, kseq_t *kseq=static_cast<kseq_t*>(nullptr), unsigned nthreads=1) {
+    auto update_fn = [&sketch](auto x) {
+        // Exact 128-bit k-mers are folded to the sketch's 64-bit identifiers
+        if constexpr(sizeof(x) > sizeof(uint64_t)) sketch.update(fold128(x));
+        else                                        sketch.update(x);
     };
+    auto batch_fn = [&update_fn](auto kmers) {for(const auto x: kmers) update_fn(x);};
     if(htype == 0) {
-        enc.for_each(update_fn, path.data(), kseq);
+        // Ordered parallel encoding emits on this thread, so the sketch needs no locking
+        if(nthreads > 1) enc.for_each_parallel(update_fn, path.data(), nthreads, kseq);
+        else             enc.for_each_batch(batch_fn, path.data(), kseq);
     } else if(htype == 1) {
-        rolling_hasher.for_each_hash(update_fn, path.data(), kseq);
+        // Short reads are hashed several at a time, one per SIMD lane
+        rolling_hasher.for_each_hash_lanes([&update_fn](size_t, uint64_t x) {update_fn(x);}, path.data(), kseq);
     } else if(htype == 2) {
-        enc.for_each_hash(update_fn, path.data(), kseq);
+        enc.for_each_hash_batch(batch_fn, path.data(), kseq);
     } else {
         std::fprintf(stderr, "Error: this should never happen. htype should be [0, 1, 2]\n");
         std::exit(EXIT_FAILURE);
@@ -69,8 +75,11 @@ void usage() {
                         "-z: Set sketch size (default: 4096)\n"
                         "-F: Load paths from <file> (in addition to positional arguments)\n"
                         "-P: Parse protein k-mers instead of DNA k-mers [this implies cyclic, avoiding direct encoding]\n"
+                        "    For 32 < k <= 64, DNA k-mers are encoded exactly as 128-bit integers and folded to 64-bit identifiers for sketching.\n"
                         "-I: Set initial buffer size for sequence parsing to [size_t] (4194304 = 4MiB)\n"
                         "-Z: Do not save sketches for individual files. Default behavior saves sketches for each file and also emits the union sketch.\n"
+                        "-x: Only sketch k-mers in a FracMinHash sample of 1/<scale> (hash <= 2^64 / scale); with -s, only these are saved [1: all k-mers]\n"
+                        "-q: Skip k-mers containing bases with Phred quality below <q> in FASTQ input [0: off]\n"
                         "-B: Store per-sample setsketches and k-mer samples in current directory instead of the file containing the sequence files\n"
         );
 }
@@ -82,11 +91,13 @@ int main(int argc, char **argv) {
         save_kmers = 0, save_kmer_counts = 0,
         save_sketches = 1;
     int k = 31, nthreads = 1;
+    unsigned minq = 0;
+    double scale = 1.;
     size_t initsize = 1ull << 20, sketchsize = 4096;
     std::FILE *logfp = stderr;
     bool basename = false;
     CSETFT startmax = std::numeric_limits<CSETFT>::max();
-    for(int c;(c = getopt(argc, argv, "BL:Y:I:k:F:o:p:z:ZPsScCNh?")) >= 0;) {
+    for(int c;(c = getopt(argc, argv, "BL:Y:I:k:F:o:p:q:x:z:ZPsScCNh?")) >= 0;) {
         switch(c) {
             case 'B': basename = true; break;
             case 'Z': save_sketches = 0; break;
@@ -103,6 +114,8 @@ int main(int argc, char **argv) {
             case 's': save_kmer_counts = save_kmers = true; break;
             case 'F': fpaths = optarg; break;
             case 'p': nthreads = std::atoi(optarg); break;
+            case 'q': minq = std::atoi(optarg); break;
+            case 'x': scale = std::atof(optarg); break;
             case 'P': enable_protein = true; kmerparsetype = "cyclic"; break;
             case 'I': initsize = std::strtoull(optarg, nullptr, 10); break;
             case 'Y': startmax = std::atof(optarg); break;
@@ -125,8 +138,8 @@ int main(int argc, char **argv) {
             std::fprintf(logfp, "Warning: enable_protein implies cyclic hashing.\n");
             kmerparsetype = "cyclic";
         }
-    } else if(k > 32 && kmerparsetype == "bns") {
-        std::fprintf(logfp, "Warning: k > 32 implies nthash-based rolling hashing.\n");
+    } else if(k > 64 && kmerparsetype == "bns") {
+        std::fprintf(logfp, "Warning: k > 64 implies nthash-based rolling hashing.\n");
         kmerparsetype = "nthash";
     }
     if((save_kmers || save_kmer_counts) && (ofile == "/dev/stdout" || ofile == "-")) {
@@ -140,6 +153,10 @@ int main(int argc, char **argv) {
     std::fprintf(logfp, "Sketching %s %u-mers, %s\n", canon ? "canonical": "stranded", k, &kmerparsetype[0]);
     RollingHasher<uint64_t> *rencoders = static_cast<RollingHasher<uint64_t> *>(std::malloc(sizeof(RollingHasher<uint64_t>) * nthreads));
     Encoder<> *encoders = static_cast<Encoder<> *>(std::malloc(sizeof(Encoder<>) * nthreads));
+    // 32 < k <= 64: encode exact 128-bit k-mers
+    const bool exact128 = k > 32 && kmerparsetype == "bns";
+    using Encoder128 = Encoder<score::Lex, u128>;
+    Encoder128 *encoders128 = exact128 ? static_cast<Encoder128 *>(std::malloc(sizeof(Encoder128) * nthreads)): nullptr;
     kseq_t *kseqs = static_cast<kseq_t *>(std::calloc(nthreads, sizeof(kseq_t)));
     SSType *sketches = static_cast<SSType *>(std::calloc(nthreads, sizeof(SSType)));
     SSType *usketches = nullptr;
@@ -152,7 +169,14 @@ int main(int argc, char **argv) {
         back.seq.m = initsize;
         back.seq.s = static_cast<char *>(std::malloc(initsize));
         new (encoders + idx) Encoder<>(k, canon);
+        if(encoders128) new (encoders128 + idx) Encoder128(k, canon);
         new (rencoders + idx) RollingHasher<uint64_t>(k, canon, rht);
+        encoders[idx].min_quality(minq);
+        if(encoders128) encoders128[idx].min_quality(minq);
+        rencoders[idx].min_quality(minq);
+        encoders[idx].scaled(scale);
+        if(encoders128) encoders128[idx].scaled(scale);
+        rencoders[idx].scaled(scale);
         new (sketches + idx) SSType(sketchsize, save_kmers, save_kmer_counts, startmax);
         if(usketches) {
             new(usketches + idx) SSType(sketchsize, save_kmers, save_kmer_counts, startmax);
@@ -162,17 +186,25 @@ int main(int argc, char **argv) {
     CSETFT maxv = 0., minv = std::numeric_limits<CSETFT>::max();
     std::atomic<uint64_t> total_processed;
     total_processed.store(0);
+    // With fewer files than threads, encode each file with every thread instead.
+    const unsigned inner = infiles.size() < size_t(nthreads) ? nthreads: 1;
 #ifdef _OPENMP
-    #pragma omp parallel for schedule(dynamic)
+    #pragma omp parallel for schedule(dynamic) if(inner == 1)
 #endif
     for(size_t i = 0; i < infiles.size(); ++i) {
         const int tid = OMP_ELSE(omp_get_thread_num(), 0);
         auto &s = sketches[tid];
         if(s.total_updates()) s.clear();
-        update_sketch(
-                encoders[tid], rencoders[tid], s, // Parsing/Sketching prep
-                infiles[i], htype, &kseqs[tid]    // Path/Sketch format/buffer
-        );
+        if(exact128)
+            update_sketch(
+                    encoders128[tid], rencoders[tid], s, // Parsing/Sketching prep
+                    infiles[i], htype, &kseqs[tid], inner // Path/Sketch format/buffer/threads
+            );
+        else
+            update_sketch(
+                    encoders[tid], rencoders[tid], s, // Parsing/Sketching prep
+                    infiles[i], htype, &kseqs[tid], inner // Path/Sketch format/buffer/threads
+            );
         const size_t scard = s.cardinality();
         ++total_processed;
         std::fprintf(logfp, "%s\t%zu. Total updates %zu for %%%f unique (%zu/%zu)\n", infiles[i].data(), scard, s.total_updates(), 100. * scard / s.total_updates(), static_cast<size_t>(total_processed.load()), infiles.size());
@@ -221,7 +253,7 @@ int main(int argc, char **argv) {
                 const auto idcp = f.idcounts().data();
                 for(size_t i = 0; i < f.ids().size(); ++i) {
                     uint64_t id = idp[i];
-                    if(htype == 0) ofshr << encoders->sp_.to_string(id);
+                    if(htype == 0 && !exact128) ofshr << encoders->sp_.to_string(id);
                     else           ofshr << id;
                     if(f.idcounts().size()) ofshr << '\t' << idcp[i];
                     ofshr << '\n';
@@ -251,6 +283,7 @@ int main(int argc, char **argv) {
         kseq_destroy_stack(kseqs[i]);
         sketches[i].~SSType();
         encoders[i].~Encoder<>();
+        if(encoders128) encoders128[i].~Encoder128();
         rencoders[i].~RollingHasher<uint64_t>();
     }
     if(usketches) {
@@ -262,6 +295,7 @@ int main(int argc, char **argv) {
     std::free(sketches);
     std::free(usketches);
     std::free(encoders);
+    std::free(encoders128);
     std::free(rencoders);
     if(logfp != stderr) std::fclose(logfp);
     return EXIT_SUCCESS;
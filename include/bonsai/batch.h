@@ -0,0 +1,51 @@
+#ifndef BNS_BATCH_H__
+#define BNS_BATCH_H__
+#include <cstddef>
+#include <cstdint>
+
+namespace bns {
+
+/*
+ * Batched k-mer emission.
+ * Encoders fill a buffer of up to `capacity` k-mers and hand it over as a KmerSpan,
+ * so that consumers can prefetch table slots or hash several k-mers at a time.
+ * A span is only valid for the duration of the callback.
+ */
+static constexpr size_t DEFAULT_BATCH_SIZE = 256;
+
+template<typename T>
+struct KmerSpan {
+    const T *data_;
+    size_t   size_;
+    const T *begin() const {return data_;}
+    const T *end()   const {return data_ + size_;}
+    const T *data()  const {return data_;}
+    size_t   size()  const {return size_;}
+    bool     empty() const {return size_ == 0;}
+    const T &operator[](size_t i) const {return data_[i];}
+};
+
+// Collects values into a caller-provided buffer, calling func(KmerSpan<T>) whenever it fills.
+// Call flush() once the input has been exhausted.
+template<typename T, typename Functor>
+struct BatchEmitter {
+    T *const buf_;
+    const size_t capacity_;
+    const Functor &func_;
+    size_t n_ = 0;
+    BatchEmitter(T *buf, size_t capacity, const Functor &func): buf_(buf), capacity_(capacity), func_(func) {}
+    void operator()(T x) {
+        buf_[n_++] = x;
+        if(n_ == capacity_) flush();
+    }
+    void flush() {
+        if(n_) {
+            func_(KmerSpan<T>{buf_, n_});
+            n_ = 0;
+        }
+    }
+};
+
+} // namespace bns
+
+#endif /* BNS_BATCH_H__ */
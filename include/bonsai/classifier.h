@@ -149,6 +149,12 @@ struct ClassifierGeneric {
         if(setting) output_flag_ |= output_format::FASTQ;
         else        output_flag_ &= (~output_format::FASTQ);
     }
+    // Skips k-mers containing bases below this Phred quality in FASTQ reads (0 disables); see Encoder::min_quality.
+    void set_min_quality(unsigned phred) {enc_.min_quality(phred);}
+    // Skips low-complexity k-mers by DUST score at this level (0 disables); see Encoder::dust.
+    void set_dust(unsigned level) {enc_.dust(level);}
+    // Classifies in homopolymer-compressed space (see Encoder::homopolymer_compress), for databases built that way.
+    void set_homopolymer_compress(bool value) {enc_.homopolymer_compress(value);}
     INLINE int get_emit_all()    const {return output_flag_ & output_format::EMIT_ALL;}
     INLINE int get_emit_kraken() const {return output_flag_ & output_format::KRAKEN;}
     INLINE int get_emit_fastq()  const {return output_flag_ & output_format::FASTQ;}
@@ -222,16 +228,35 @@ unsigned classify_seq(const ClassifierGeneric<ScoreType> &c,
     bks.clear();
     taxa.clear();
 
-    auto fn = [&] (u64 kmer) {
+    auto fn = [&] (KmerSpan<u64> kmers) {
+        // Prefetch each k-mer's first probe before looking any of them up.
+        if(c.db_->n_buckets) {
+            const khint_t mask = c.db_->n_buckets - 1;
+            for(const u64 kmer: kmers) __builtin_prefetch(&c.db_->keys[__ac_Wang64_hash(kmer) & mask]);
+        }
         //If the kmer is missing from our database, just say we don't know what it is.
-        if((ki = kh_get(c, c.db_, kmer)) == kh_end(c.db_)) ++missing_count;
-        else taxa.push_back(kh_val(c.db_, ki)), hit_counts.add(kh_val(c.db_, ki));
+        for(const u64 kmer: kmers) {
+            if((ki = kh_get(c, c.db_, kmer)) == kh_end(c.db_)) ++missing_count;
+            else taxa.push_back(kh_val(c.db_, ki)), hit_counts.add(kh_val(c.db_, ki));
+        }
+    };
+    // Windowed encoders repeat a minimizer for every window of a super-k-mer, so look each one up once
+    // and count it once per window it covers.
+    auto sfn = [&] (u64 kmer, u64 start, u64 end) {
+        const unsigned n = enc.superkmer_windows(start, end);
+        if((ki = kh_get(c, c.db_, kmer)) == kh_end(c.db_)) missing_count += n;
+        else taxa.insert(taxa.end(), n, kh_val(c.db_, ki)), hit_counts.add(kh_val(c.db_, ki), n);
+    };
+    auto run = [&](const bseq1_t *rec) {
+        const char *s = enc.record_seq(rec->seq, rec->qual, rec->l_seq);
+        if(enc.sp_.unwindowed()) enc.for_each_batch(fn, s, rec->l_seq);
+        else                     enc.for_each_superkmer(sfn, s, rec->l_seq);
     };
     // This simplification loses information about the run of congituous labels. Do these matter?
-    enc.for_each(fn, bs->seq, bs->l_seq);
+    run(bs);
     unsigned ambig_count(bs->l_seq - enc.sp_.c_ + 1 - taxa.size() - missing_count);
     if(is_paired) {
-        enc.for_each(fn, (bs + 1)->seq, (bs + 1)->l_seq);
+        run(bs + 1);
         ambig_count += (bs + 1)->l_seq - (enc.sp_.c_ - 1) - taxa.size() - missing_count;
     }
 
@@ -299,6 +324,7 @@ inline void process_dataset(const Classifier &c, const khash_t(p) *taxmap, const
     // TODO: consider reusing buffers for processing large numbers of files.
     int nseq(0), max_nseq(0);
     gzFile ifp1(gzopen(fq1, "rb")), ifp2(fq2 ? gzopen(fq2, "rb"): nullptr);
+    ReadAhead ra1(ifp1), ra2(ifp2); // Inflate on helper threads while classifying
     kseq_t *ks1(kseq_init(ifp1)), *ks2(ifp2 ? kseq_init(ifp2): nullptr);
     ks::string cks(256u);
     const int fn = fileno(out), is_paired(fq2 != 0);
@@ -330,6 +356,8 @@ inline void process_dataset(const Classifier &c, const khash_t(p) *taxmap, const
     free(dd.seqs_);
     fail:
     // Clean up.
+    ra1.stop();
+    ra2.stop();
     gzclose(ifp1);
     kseq_destroy(ks1);
     if(ks2) kseq_destroy(ks2);
@@ -2,6 +2,7 @@
 #define _DATABASE_H__
 
 #include "encoder.h"
+#include "decompress.h"
 #include "util.h"
 #include <cinttypes>
 #include <forward_list>
@@ -12,6 +13,14 @@
 
 namespace bns {
 
+/*
+ * On-disk layout: DB_MAGIC, the format version and the alphabet (a uint32_t each), then k, w, the spacing and the table.
+ * Files written before the header existed begin with k; they are read as version 1 DNA databases.
+ * Version 2 changed PROTEIN20, PROTEIN_14 and PROTEIN_6 k-mers from (min * mul) | c to min * mul + c
+ * (see Encoder::mixed_radix), so databases over those alphabets are only read at the version that wrote them.
+ */
+static constexpr uint32_t DB_MAGIC   = 0x42444e42u; // "BNDB"
+static constexpr uint32_t DB_VERSION = 2;
 
 template <typename T>
 struct Database {
@@ -21,6 +30,8 @@ struct Database {
     int      owns_hash_;
     spvec_t  s_;
     Spacer  *sp_;
+    uint32_t version_  = DB_VERSION;
+    uint32_t alphabet_ = DNA; // InputType of the encoded k-mers
 
     Spacer *make_sp() {
         //std::fprintf(stderr, "Making sp with spacer = %s\n", str(s_).data());
@@ -31,28 +42,29 @@ struct Database {
     }
 
     Database(const char *fn): owns_hash_(1), sp_(nullptr) {
-        int filetype(0);
-        {
-            std::string fns = fn;
-            std::string gzsuf   = ".gz";
-            std::string zstdsuf = ".zst";
-            if(std::equal(std::crbegin(gzsuf), std::crend(gzsuf), std::crbegin(fns))) filetype = 1;
-            else if(std::equal(std::crbegin(gzsuf), std::crend(gzsuf), std::crbegin(fns))) filetype = 2;
-        }
-        std::FILE *fp = filetype ? popen((std::string(filetype == 1 ? "gzip -dc " : "zstd -qdc ") + fn).data(), "rb"): std::fopen(fn, "rb");
+        // Compression (gzip, zstd, xz or bzip2) is detected from the file's contents.
+        // fp is declared after reader, so it is closed first (even on an exception) and the reader's thread can exit.
+        DecompressingReader reader(fn);
+        std::unique_ptr<std::FILE, int (*)(std::FILE *)> fp(reader.file(), std::fclose);
         if (fp) {
-            __fr(k_, fp);
-            __fr(w_, fp);
+            uint32_t magic;
+            __fr(magic, fp.get());
+            if(magic == DB_MAGIC) {
+                __fr(version_, fp.get());
+                __fr(alphabet_, fp.get());
+                __fr(k_, fp.get());
+            } else k_ = magic, version_ = 1, alphabet_ = DNA;
+            check_version();
+            __fr(w_, fp.get());
             s_ = spvec_t(k_ - 1);
             LOG_DEBUG("reading %zu bytes from file for vector, with %zu reserved\n", s_.size(), s_.capacity());
-            if(std::fread(s_.data(), s_.size(), sizeof(uint8_t), fp) != s_.size() * sizeof(uint8_t))
+            if(std::fread(s_.data(), s_.size(), sizeof(uint8_t), fp.get()) != s_.size() * sizeof(uint8_t))
                 throw std::runtime_error("Error: Could not read spacing from file");
-            db_ = khash_load_impl<T>(fp);
+            db_ = khash_load_impl<T>(fp.get());
         } else LOG_EXIT("Could not open %s for reading.\n", fn);
         sp_ = make_sp();
         assert(sp_);
         LOG_DEBUG("Read database!\n");
-        std::fclose(fp);
     }
     Database(unsigned k, unsigned w, const spvec_t &s, unsigned owns=1, T *db=nullptr):
         k_(k), w_(w), db_(db), owns_hash_(owns), s_(s), sp_(make_sp())
@@ -70,20 +82,34 @@ struct Database {
         db_(nullptr),
         owns_hash_(owns),
         s_(other.s_),
-        sp_(make_sp())
+        sp_(make_sp()),
+        alphabet_(other.alphabet_)
     {
     }
 
+    void check_version() const {
+        if(version_ > DB_VERSION)
+            throw std::runtime_error("Error: database format version " + std::to_string(version_)
+                                     + " is newer than this build's (" + std::to_string(DB_VERSION) + ")");
+        if(version_ != DB_VERSION && (alphabet_ == PROTEIN20 || alphabet_ == PROTEIN_14 || alphabet_ == PROTEIN_6))
+            throw std::runtime_error("Error: database holds PROTEIN20/14/6 k-mers in the encoding of format version "
+                                     + std::to_string(version_) + ", which this build does not produce. Rebuild it.");
+    }
+
     ~Database() {
         if(owns_hash_) khash_destroy(db_);
         if(sp_)        delete sp_;
     }
     void write(const char *fn, bool write_gz=false) const {
         // TODO: add compression/work with zlib.
+        const uint32_t magic = DB_MAGIC, version = DB_VERSION;
         if(write_gz) {
             gzFile ofp = gzopen(fn, "wb");
             if(!ofp) LOG_EXIT("Could not open %s for writing.\n", fn);
 #define gzw(_x, ofp) if(gzwrite(ofp, static_cast<const void *>(&_x), sizeof(_x)) != sizeof(_x)) throw std::runtime_error("Error writing to file")
+            gzw(magic, ofp);
+            gzw(version, ofp);
+            gzw(alphabet_, ofp);
             gzw(k_, ofp);
             gzw(w_, ofp);
             gzwrite(ofp, static_cast<const void *>(s_.data()), s_.size() * sizeof(s_[0]));
@@ -94,6 +120,9 @@ struct Database {
         } // else
         std::FILE *ofp(std::fopen(fn, "wb"));
         if(!ofp) LOG_EXIT("Could not open %s for writing.\n", fn);
+        __fw(magic, ofp);
+        __fw(version, ofp);
+        __fw(alphabet_, ofp);
         __fw(k_, ofp);
         __fw(w_, ofp);
         if(std::fwrite(s_.data(), s_.size(), sizeof(uint8_t), ofp) != s_.size()) throw std::runtime_error("Error writing database");
@@ -0,0 +1,471 @@
+#ifndef BNS_DECOMPRESS_H__
+#define BNS_DECOMPRESS_H__
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "util.h"
+#include "readahead.h"
+
+/*
+ * Optional decompression libraries, enabled by the Makefile when their headers and libraries are found.
+ * Without them, gzip is inflated with zlib and the other formats are piped through their command-line tools.
+ */
+#ifndef BNS_HAVE_LIBDEFLATE
+#  define BNS_HAVE_LIBDEFLATE 0
+#endif
+#ifndef BNS_HAVE_ZSTD
+#  define BNS_HAVE_ZSTD 0
+#endif
+#ifndef BNS_HAVE_LZMA
+#  define BNS_HAVE_LZMA 0
+#endif
+#ifndef BNS_HAVE_BZ2
+#  define BNS_HAVE_BZ2 0
+#endif
+#if BNS_HAVE_LIBDEFLATE
+#  include <libdeflate.h>
+#endif
+#if BNS_HAVE_ZSTD
+#  include <zstd.h>
+#endif
+#if BNS_HAVE_LZMA
+#  include <lzma.h>
+#endif
+#if BNS_HAVE_BZ2
+#  include <bzlib.h>
+#endif
+
+extern char **environ;
+
+namespace bns {
+
+enum class CompressionFormat: int {
+    NONE,
+    GZIP,
+    ZSTD,
+    XZ,
+    BZIP2
+};
+
+static inline const char *format_name(CompressionFormat fmt) {
+    switch(fmt) {
+        case CompressionFormat::GZIP:  return "gzip";
+        case CompressionFormat::ZSTD:  return "zstd";
+        case CompressionFormat::XZ:    return "xz";
+        case CompressionFormat::BZIP2: return "bzip2";
+        default:                       return "none";
+    }
+}
+
+// Identifies a compressed stream by its leading magic bytes, ignoring file names.
+static inline CompressionFormat detect_compression(const unsigned char *s, size_t n) {
+    if(n >= 2 && s[0] == 0x1f && s[1] == 0x8b) return CompressionFormat::GZIP;
+    // zstd frames, or skippable frames (magic 0x184D2A5?), which zstd also skips
+    if(n >= 4 && ((s[0] == 0x28 && s[1] == 0xb5 && s[2] == 0x2f && s[3] == 0xfd) ||
+                  ((s[0] & 0xF0) == 0x50 && s[1] == 0x2a && s[2] == 0x4d && s[3] == 0x18)))
+        return CompressionFormat::ZSTD;
+    if(n >= 6 && std::memcmp(s, "\xfd" "7zXZ\0", 6) == 0) return CompressionFormat::XZ;
+    if(n >= 3 && s[0] == 'B' && s[1] == 'Z' && s[2] == 'h') return CompressionFormat::BZIP2;
+    return CompressionFormat::NONE;
+}
+
+namespace detail {
+
+static constexpr size_t DECOMPRESS_CHUNK = 1 << 20;
+
+// Writes [buf, buf + n) to fd, returning false once the reader has closed its end.
+static inline bool write_all(int fd, const void *buf, size_t n) {
+    auto p = static_cast<const char *>(buf);
+    while(n) {
+        const ssize_t rc = ::write(fd, p, n);
+        if(rc < 0) {
+            if(errno == EINTR) continue;
+            if(errno == EPIPE) return false;
+            UNRECOVERABLE_ERROR(std::string("Failed to write decompressed data: ") + std::strerror(errno));
+        }
+        p += rc; n -= rc;
+    }
+    return true;
+}
+
+static inline void truncated(const char *path, CompressionFormat fmt) {
+    UNRECOVERABLE_ERROR(std::string("Truncated ") + format_name(fmt) + " stream in " + path);
+}
+
+/*
+ * The input file, read from the descriptor it was opened with.
+ * The bytes read to identify its format are replayed first if the file cannot seek back to them (e.g., a pipe).
+ * read returns 0 only at the end of the file.
+ */
+struct Input {
+    int fd = -1;
+    unsigned char head[6];
+    size_t nhead = 0, headoff = 0;
+    const char *path = "";
+    size_t read(void *buf, size_t n) {
+        if(headoff < nhead) {
+            const size_t ret = std::min(n, nhead - headoff);
+            std::memcpy(buf, head + headoff, ret);
+            headoff += ret;
+            return ret;
+        }
+        ssize_t rc;
+        while((rc = ::read(fd, buf, n)) < 0)
+            if(errno != EINTR) UNRECOVERABLE_ERROR(std::string("Failed to read ") + path + ": " + std::strerror(errno));
+        return rc;
+    }
+};
+
+static constexpr size_t BGZF_MAX_BLOCK = 1 << 16; // Bounds both the compressed and decompressed size of a BGZF block
+
+#if BNS_HAVE_LIBDEFLATE
+
+// Returns the size of the BGZF block (a gzip member which records its compressed size in its extra field) at s, or 0.
+static inline size_t bgzf_block_size(const uint8_t *s, size_t n) {
+    if(n < 12 || s[0] != 0x1f || s[1] != 0x8b || s[2] != 8 || !(s[3] & 4)) return 0;
+    const size_t xend = 12 + (s[10] | (s[11] << 8));
+    if(n < xend) return 0;
+    for(size_t i = 12; i + 4 <= xend; i += 4 + (s[i + 2] | (s[i + 3] << 8)))
+        if(s[i] == 'B' && s[i + 1] == 'C' && s[i + 2] == 2 && s[i + 3] == 0 && i + 6 <= xend)
+            return (s[i + 4] | (s[i + 5] << 8)) + 1;
+    return 0;
+}
+#endif
+
+/*
+ * Inflates concatenated gzip members (e.g., from bgzip, or from concatenating gzip files) with zlib's streaming decoder.
+ * With libdeflate, BGZF blocks, whose output is bounded by the format, are instead decompressed whole.
+ * Memory use is fixed, whatever the size of a member.
+ */
+static inline void inflate_gzip(Input &in, int out, const char *path) {
+    std::unique_ptr<uint8_t[]> ibuf(new uint8_t[DECOMPRESS_CHUNK]), obuf(new uint8_t[DECOMPRESS_CHUNK]);
+    size_t lo = 0, hi = 0; // Unconsumed input
+    auto fill = [&]() {
+        if(lo) {
+            std::memmove(ibuf.get(), ibuf.get() + lo, hi - lo);
+            hi -= lo; lo = 0;
+        }
+        const size_t n = in.read(ibuf.get() + hi, DECOMPRESS_CHUNK - hi);
+        hi += n;
+        return n;
+    };
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    if(inflateInit2(&zs, 15 + 16) != Z_OK) UNRECOVERABLE_ERROR("Failed to initialize zlib");
+#if BNS_HAVE_LIBDEFLATE
+    libdeflate_decompressor *d = libdeflate_alloc_decompressor();
+#endif
+    for(bool open = true, first = true; open; first = false) {
+        while(hi - lo < BGZF_MAX_BLOCK && fill());
+        if(lo == hi) break;
+        if(!first && ibuf[lo] != 0x1f) break; // Trailing garbage after a member, which gzread also ignores
+#if BNS_HAVE_LIBDEFLATE
+        const size_t bsize = bgzf_block_size(ibuf.get() + lo, hi - lo);
+        size_t nout;
+        if(bsize && bsize <= hi - lo &&
+           libdeflate_gzip_decompress(d, ibuf.get() + lo, bsize, obuf.get(), BGZF_MAX_BLOCK, &nout) == LIBDEFLATE_SUCCESS) {
+            open = write_all(out, obuf.get(), nout);
+            lo += bsize;
+            continue;
+        }
+#endif
+        inflateReset(&zs);
+        zs.next_in = ibuf.get() + lo; zs.avail_in = hi - lo;
+        // A full output buffer may leave output pending even once the input is consumed.
+        for(bool pending = false;;) {
+            if(zs.avail_in == 0 && !pending) {
+                lo = hi;
+                if(!fill()) truncated(path, CompressionFormat::GZIP);
+                zs.next_in = ibuf.get(); zs.avail_in = hi;
+            }
+            zs.next_out = obuf.get(); zs.avail_out = DECOMPRESS_CHUNK;
+            const int rc = inflate(&zs, Z_NO_FLUSH);
+            if(rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR)
+                UNRECOVERABLE_ERROR(std::string("Corrupt gzip stream in ") + path + ": " + (zs.msg ? zs.msg: "unknown error"));
+            pending = zs.avail_out == 0;
+            // Once the reader has closed its end, stop, without reporting the stream as truncated.
+            if(!(open = write_all(out, obuf.get(), DECOMPRESS_CHUNK - zs.avail_out)) || rc == Z_STREAM_END) break;
+        }
+        lo = hi - zs.avail_in;
+    }
+#if BNS_HAVE_LIBDEFLATE
+    libdeflate_free_decompressor(d);
+#endif
+    inflateEnd(&zs);
+}
+
+// Copies input which needs no decompression, for unseekable input whose first bytes were consumed to identify it.
+static inline void copy_input(Input &in, int out) {
+    std::unique_ptr<char[]> buf(new char[DECOMPRESS_CHUNK]);
+    for(size_t n; (n = in.read(buf.get(), DECOMPRESS_CHUNK)) && write_all(out, buf.get(), n););
+}
+
+#if BNS_HAVE_ZSTD
+static inline void decompress_zstd(Input &in, int out, const char *path) {
+    const size_t isz = ZSTD_DStreamInSize(), osz = ZSTD_DStreamOutSize();
+    std::unique_ptr<uint8_t[]> ibuf(new uint8_t[isz]), obuf(new uint8_t[osz]);
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    size_t rc = 0, nread;
+    bool open = true;
+    while(open && (nread = in.read(ibuf.get(), isz))) {
+        ZSTD_inBuffer zin{ibuf.get(), nread, 0};
+        // A full output buffer may leave decompressed data buffered in dctx even once the input is consumed,
+        // unless the frame is complete (rc == 0): calling again then would start a new frame and report it as unfinished.
+        for(bool full = true; open && (zin.pos < zin.size || full);) {
+            ZSTD_outBuffer zout{obuf.get(), osz, 0};
+            rc = ZSTD_decompressStream(dctx, &zout, &zin);
+            if(ZSTD_isError(rc)) UNRECOVERABLE_ERROR(std::string("Corrupt zstd stream in ") + path + ": " + ZSTD_getErrorName(rc));
+            open = write_all(out, obuf.get(), zout.pos);
+            full = rc && zout.pos == zout.size;
+        }
+    }
+    ZSTD_freeDCtx(dctx);
+    if(open && rc) truncated(path, CompressionFormat::ZSTD);
+}
+#endif
+
+#if BNS_HAVE_LZMA
+static inline void decompress_xz(Input &in, int out, const char *path) {
+    std::unique_ptr<uint8_t[]> ibuf(new uint8_t[DECOMPRESS_CHUNK]), obuf(new uint8_t[DECOMPRESS_CHUNK]);
+    lzma_stream strm = LZMA_STREAM_INIT;
+#if LZMA_VERSION >= UINT32_C(50040002)
+    // Files written by xz -T split into blocks, which the multithreaded decoder decompresses in parallel.
+    lzma_mt mt;
+    std::memset(&mt, 0, sizeof(mt));
+    mt.flags = LZMA_CONCATENATED;
+    mt.threads = std::max(1u, std::thread::hardware_concurrency());
+    mt.memlimit_threading = std::max(lzma_physmem() / 4, uint64_t(1) << 28);
+    mt.memlimit_stop = UINT64_MAX;
+    lzma_ret rc = lzma_stream_decoder_mt(&strm, &mt);
+#else
+    lzma_ret rc = lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED);
+#endif
+    if(rc != LZMA_OK) UNRECOVERABLE_ERROR("Failed to initialize liblzma");
+    lzma_action action = LZMA_RUN;
+    for(bool open = true; open && rc != LZMA_STREAM_END;) {
+        if(strm.avail_in == 0 && action == LZMA_RUN) {
+            strm.next_in = ibuf.get();
+            if((strm.avail_in = in.read(ibuf.get(), DECOMPRESS_CHUNK)) == 0) action = LZMA_FINISH;
+        }
+        strm.next_out = obuf.get(); strm.avail_out = DECOMPRESS_CHUNK;
+        rc = lzma_code(&strm, action);
+        if(rc != LZMA_OK && rc != LZMA_STREAM_END) {
+            if(rc == LZMA_BUF_ERROR) truncated(path, CompressionFormat::XZ);
+            UNRECOVERABLE_ERROR(std::string("Corrupt xz stream in ") + path + " (lzma_ret " + std::to_string(int(rc)) + ')');
+        }
+        open = write_all(out, obuf.get(), DECOMPRESS_CHUNK - strm.avail_out);
+    }
+    lzma_end(&strm);
+}
+#endif
+
+#if BNS_HAVE_BZ2
+static inline void decompress_bz2(Input &in, int out, const char *path) {
+    std::unique_ptr<char[]> ibuf(new char[DECOMPRESS_CHUNK]), obuf(new char[DECOMPRESS_CHUNK]);
+    bz_stream strm;
+    std::memset(&strm, 0, sizeof(strm));
+    if(BZ2_bzDecompressInit(&strm, 0, 0) != BZ_OK) UNRECOVERABLE_ERROR("Failed to initialize libbz2");
+    int rc = BZ_OK;
+    bool open = true, pending = false;
+    while(open) {
+        if(strm.avail_in == 0 && !pending) {
+            if((strm.avail_in = in.read(ibuf.get(), DECOMPRESS_CHUNK)) == 0) break;
+            strm.next_in = ibuf.get();
+        }
+        // As with bzip2 -d, concatenated streams (e.g., from pbzip2) are decompressed back-to-back.
+        if(rc == BZ_STREAM_END) {
+            if(strm.next_in[0] != 'B') break;
+            BZ2_bzDecompressEnd(&strm);
+            char *next = strm.next_in;
+            const unsigned avail = strm.avail_in;
+            std::memset(&strm, 0, sizeof(strm));
+            BZ2_bzDecompressInit(&strm, 0, 0);
+            strm.next_in = next; strm.avail_in = avail;
+        }
+        strm.next_out = obuf.get(); strm.avail_out = DECOMPRESS_CHUNK;
+        rc = BZ2_bzDecompress(&strm);
+        if(rc != BZ_OK && rc != BZ_STREAM_END)
+            UNRECOVERABLE_ERROR(std::string("Corrupt bzip2 stream in ") + path + " (error " + std::to_string(rc) + ')');
+        pending = rc != BZ_STREAM_END && strm.avail_out == 0;
+        open = write_all(out, obuf.get(), DECOMPRESS_CHUNK - strm.avail_out);
+    }
+    BZ2_bzDecompressEnd(&strm);
+    if(open && rc != BZ_STREAM_END) truncated(path, CompressionFormat::BZIP2);
+}
+#endif
+
+static inline bool in_process(CompressionFormat fmt) {
+    switch(fmt) {
+        case CompressionFormat::GZIP:  return true;
+        case CompressionFormat::ZSTD:  return BNS_HAVE_ZSTD;
+        case CompressionFormat::XZ:    return BNS_HAVE_LZMA;
+        case CompressionFormat::BZIP2: return BNS_HAVE_BZ2;
+        default:                       return false;
+    }
+}
+
+} // namespace detail
+
+/*
+ * DecompressingReader opens a file which may be gzip-, zstd-, xz- or bzip2-compressed, identified by its magic bytes,
+ * and exposes its decompressed contents as a gzFile (for kseq) or a std::FILE *.
+ * Compressed input is decompressed by a dedicated thread into a pipe, so that decompression overlaps with parsing
+ * and hashing, except that gzFiles for uncompressed input or (without libdeflate) gzip are handed to zlib directly,
+ * and, in with_gzfile, to a ReadAhead to move off the parsing thread.
+ * The file is only opened once, so pipes, FIFOs and /dev/stdin work: if it cannot seek back to the start,
+ * the bytes read to identify it are replayed through the thread.
+ * The handle returned by gzfile() or file() belongs to the caller, who must close it before the reader is destroyed.
+ * Closing it early is fine: the thread stops once its writes fail.
+ */
+class DecompressingReader {
+    std::string path_;
+    CompressionFormat fmt_ = CompressionFormat::NONE;
+    detail::Input in_;
+    pid_t child_ = -1;           // Command-line decompressor, if built without the format's library
+    int fd_ = -1;                // Decompressed output, until handed off
+    std::thread worker_;
+
+    static void open_pipe(int fds[2]) {
+        // Close-on-exec, so that decompressors spawned by other readers do not hold them open.
+        if(::pipe(fds)) UNRECOVERABLE_ERROR(std::string("Failed to create pipe: ") + std::strerror(errno));
+        for(int i = 0; i < 2; ++i) ::fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+#ifdef F_SETPIPE_SZ
+        ::fcntl(fds[1], F_SETPIPE_SZ, int(detail::DECOMPRESS_CHUNK)); // Fewer context switches; failure is harmless
+#endif
+    }
+    // Runs the format's command-line tool directly (without a shell, so any path is safe), from in to out.
+    void spawn(int in, int out) {
+        const char *tool = fmt_ == CompressionFormat::XZ ? "xz": fmt_ == CompressionFormat::BZIP2 ? "bzip2": "zstd";
+        char *const argv[] {const_cast<char *>(tool), const_cast<char *>("-dc"), nullptr};
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+        const int rc = ::posix_spawnp(&child_, tool, &actions, nullptr, argv, environ);
+        posix_spawn_file_actions_destroy(&actions);
+        if(rc) {
+            child_ = -1;
+            UNRECOVERABLE_ERROR(std::string("Failed to run ") + tool + " -dc for " + path_ + ": " + std::strerror(rc));
+        }
+    }
+    // Runs a thread which decompresses (or, if decode is false, copies) in_ to out, then closes out.
+    void run(int out, bool decode) {
+        worker_ = std::thread([this,out,decode]() {
+            // A closed read end makes writes fail with EPIPE instead of raising SIGPIPE for the process.
+            sigset_t set;
+            sigemptyset(&set);
+            sigaddset(&set, SIGPIPE);
+            pthread_sigmask(SIG_BLOCK, &set, nullptr);
+            switch(decode ? fmt_: CompressionFormat::NONE) {
+                case CompressionFormat::GZIP:  detail::inflate_gzip(in_, out, path_.data()); break;
+#if BNS_HAVE_ZSTD
+                case CompressionFormat::ZSTD:  detail::decompress_zstd(in_, out, path_.data()); break;
+#endif
+#if BNS_HAVE_LZMA
+                case CompressionFormat::XZ:    detail::decompress_xz(in_, out, path_.data()); break;
+#endif
+#if BNS_HAVE_BZ2
+                case CompressionFormat::BZIP2: detail::decompress_bz2(in_, out, path_.data()); break;
+#endif
+                default: detail::copy_input(in_, out); break;
+            }
+            ::close(out);
+        });
+    }
+    void start() {
+        int fds[2];
+        open_pipe(fds);
+        fd_ = fds[0];
+        if(fmt_ == CompressionFormat::NONE || detail::in_process(fmt_)) {
+            run(fds[1], true);
+            return;
+        }
+        if(in_.nhead == 0) {
+            spawn(in_.fd, fds[1]);
+        } else {
+            // The tool needs the bytes already read, so they are fed to it, followed by the rest of the input.
+            int feed[2];
+            open_pipe(feed);
+            spawn(feed[0], fds[1]);
+            ::close(feed[0]);
+            run(feed[1], false);
+        }
+        ::close(fds[1]);
+    }
+    // Whether input which needs no decompression thread can be handed over as is.
+    bool direct(bool zlib) const {
+        return in_.nhead == 0 && (fmt_ == CompressionFormat::NONE || (zlib && fmt_ == CompressionFormat::GZIP && !BNS_HAVE_LIBDEFLATE));
+    }
+    template<typename T>
+    static T *adopt(T *handle, int &fd) {
+        if(handle) fd = -1;
+        return handle;
+    }
+public:
+    explicit DecompressingReader(const char *path): path_(path) {
+        in_.path = path_.data();
+        if((in_.fd = ::open(path, O_RDONLY | O_CLOEXEC)) < 0) return; // Reported by gzfile() or file() returning null
+        for(size_t n; in_.nhead < sizeof(in_.head) && (n = in_.read(in_.head + in_.nhead, sizeof(in_.head) - in_.nhead));)
+            in_.nhead += n;
+        fmt_ = detect_compression(in_.head, in_.nhead);
+        if(::lseek(in_.fd, 0, SEEK_SET) == 0) in_.nhead = 0; // Read it again from the start instead
+    }
+    explicit DecompressingReader(const std::string &path): DecompressingReader(path.data()) {}
+    DecompressingReader(const DecompressingReader &) = delete;
+    DecompressingReader &operator=(const DecompressingReader &) = delete;
+    ~DecompressingReader() {
+        if(fd_ >= 0) ::close(fd_);
+        if(worker_.joinable()) worker_.join();
+        if(in_.fd >= 0) ::close(in_.fd);
+        if(child_ > 0) while(::waitpid(child_, nullptr, 0) < 0 && errno == EINTR);
+    }
+    CompressionFormat format() const {return fmt_;}
+    // Whether the handle returned is fed by a decompressing thread or process.
+    bool threaded() const {return worker_.joinable() || child_ > 0;}
+    // Only one of these may be called, once.
+    gzFile gzfile() {
+        if(in_.fd < 0) return nullptr;
+        if(direct(true)) return adopt(gzdopen(in_.fd, "rb"), in_.fd);
+        start();
+        return adopt(gzdopen(fd_, "rb"), fd_);
+    }
+    std::FILE *file() {
+        if(in_.fd < 0) return nullptr;
+        if(direct(false)) return adopt(::fdopen(in_.fd, "rb"), in_.fd);
+        start();
+        return adopt(::fdopen(fd_, "rb"), fd_);
+    }
+};
+
+/*
+ * Opens path with a DecompressingReader and calls func(fp) with the resulting gzFile,
+ * which is read ahead on a helper thread (see readahead.h) unless it is already fed by one.
+ * Returns false if path could not be opened.
+ */
+template<typename Func>
+static inline bool with_gzfile(const char *path, const Func &func) {
+    // Destroyed in reverse: the read-ahead thread stops, then the file is closed, then any decompressing thread exits.
+    DecompressingReader reader(path);
+    std::unique_ptr<std::remove_pointer_t<gzFile>, int (*)(gzFile)> fp(reader.gzfile(), gzclose);
+    if(!fp) return false;
+    gzbuffer(fp.get(), 1<<18);
+    ReadAhead ra(fp.get(), !reader.threaded());
+    func(fp.get());
+    return true;
+}
+
+} // namespace bns
+
+#endif /* BNS_DECOMPRESS_H__ */
@@ -0,0 +1,201 @@
+#ifndef BNS_DNAPACK_H__
+#define BNS_DNAPACK_H__
+#include <cstdint>
+#include <cstring>
+#include <string>
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#endif
+
+namespace bns {
+
+/*
+ * Block nucleotide packing.
+ * pack_dna64 converts 64 input characters at a time into 2-bit codes (A: 0, C: 1, G: 2, T: 3),
+ * matching the DNA4 alphabet for ACGT/acgt.
+ * Codes are stored low-first: base i of each half-block lives at bits [2i, 2i + 2) of w[i / 32],
+ * so rolling a k-mer from a packed word is `kmer = (kmer << 2) | (w & 3); w >>= 2;`.
+ * Every other byte is reported in `bad` (bit i set for position i) and packs as 0.
+ * Callers are responsible for deciding what a flagged byte means (e.g., consult a LUT).
+ */
+struct PackedDNABlock {
+    static constexpr unsigned BLOCK_SIZE = 64;
+    uint64_t w[2];
+    uint64_t bad;
+};
+
+namespace detail {
+static inline uint64_t pack_dna32_scalar(const char *s, uint32_t &bad) {
+    uint64_t ret = 0;
+    uint32_t b = 0;
+    for(unsigned i = 0; i < 32; ++i) {
+        uint64_t v;
+        switch(s[i]) {
+            case 'A': case 'a': v = 0; break;
+            case 'C': case 'c': v = 1; break;
+            case 'G': case 'g': v = 2; break;
+            case 'T': case 't': v = 3; break;
+            default: v = 0; b |= uint32_t(1) << i;
+        }
+        ret |= v << (i * 2);
+    }
+    bad = b;
+    return ret;
+}
+#if __AVX2__
+// Indexed by the low nibble of an upper-cased base: A (0x41) -> 0, C (0x43) -> 1, G (0x47) -> 2, T (0x54) -> 3.
+static inline __m256i dna_nibble_lut256() {
+    return _mm256_setr_epi8(0, 0, 0, 1, 3, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0,
+                            0, 0, 0, 1, 3, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0);
+}
+static inline uint64_t pack_dna32_avx2(const char *s, uint32_t &bad) {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s));
+    const __m256i up = _mm256_and_si256(v, _mm256_set1_epi8(static_cast<char>(0xDF)));
+    const __m256i valid = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(up, _mm256_set1_epi8('A')), _mm256_cmpeq_epi8(up, _mm256_set1_epi8('C'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(up, _mm256_set1_epi8('G')), _mm256_cmpeq_epi8(up, _mm256_set1_epi8('T'))));
+    bad = ~static_cast<uint32_t>(_mm256_movemask_epi8(valid));
+    __m256i codes = _mm256_shuffle_epi8(dna_nibble_lut256(), _mm256_and_si256(up, _mm256_set1_epi8(0xF)));
+    codes = _mm256_and_si256(codes, valid);
+    // 2 bits/byte -> 4 bits/16-bit lane -> 8 bits/32-bit lane
+    codes = _mm256_maddubs_epi16(codes, _mm256_set1_epi16(0x0401));
+    codes = _mm256_madd_epi16(codes, _mm256_set1_epi32(0x00100001));
+    // Gather the low byte of each 32-bit lane into the low 4 bytes of each 128-bit lane
+    codes = _mm256_shuffle_epi8(codes, _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                                        0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1));
+    return static_cast<uint32_t>(_mm256_extract_epi32(codes, 0))
+        | (static_cast<uint64_t>(static_cast<uint32_t>(_mm256_extract_epi32(codes, 4))) << 32);
+}
+#endif
+} // namespace detail
+
+static inline void pack_dna64(const char *s, PackedDNABlock &blk) {
+#if __AVX512BW__
+    const __m512i v = _mm512_loadu_si512(s);
+    const __m512i up = _mm512_and_si512(v, _mm512_set1_epi8(static_cast<char>(0xDF)));
+    const __mmask64 valid = _mm512_cmpeq_epi8_mask(up, _mm512_set1_epi8('A'))
+                          | _mm512_cmpeq_epi8_mask(up, _mm512_set1_epi8('C'))
+                          | _mm512_cmpeq_epi8_mask(up, _mm512_set1_epi8('G'))
+                          | _mm512_cmpeq_epi8_mask(up, _mm512_set1_epi8('T'));
+    blk.bad = ~static_cast<uint64_t>(valid);
+    const __m512i lut = _mm512_broadcast_i32x4(_mm_setr_epi8(0, 0, 0, 1, 3, 0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0));
+    __m512i codes = _mm512_maskz_shuffle_epi8(valid, lut, _mm512_and_si512(up, _mm512_set1_epi8(0xF)));
+    codes = _mm512_maddubs_epi16(codes, _mm512_set1_epi16(0x0401));
+    codes = _mm512_madd_epi16(codes, _mm512_set1_epi32(0x00100001));
+    const __m128i packed = _mm512_cvtepi32_epi8(codes);
+    blk.w[0] = static_cast<uint64_t>(_mm_cvtsi128_si64(packed));
+    blk.w[1] = static_cast<uint64_t>(_mm_extract_epi64(packed, 1));
+#elif __AVX2__
+    uint32_t b0, b1;
+    blk.w[0] = detail::pack_dna32_avx2(s, b0);
+    blk.w[1] = detail::pack_dna32_avx2(s + 32, b1);
+    blk.bad = b0 | (static_cast<uint64_t>(b1) << 32);
+#else
+    uint32_t b0, b1;
+    blk.w[0] = detail::pack_dna32_scalar(s, b0);
+    blk.w[1] = detail::pack_dna32_scalar(s + 32, b1);
+    blk.bad = b0 | (static_cast<uint64_t>(b1) << 32);
+#endif
+}
+
+/*
+ * skip_n_run returns the index of the first character at or after pos in s[0, l) which is not 'N' or 'n'
+ * (or l if there is none), examining 64 (AVX-512BW), 32 (AVX2) or 8 (scalar) bytes at a time.
+ * Encoders call this after an ambiguous character to jump over assembly gaps.
+ */
+static inline size_t skip_n_run(const char *s, size_t pos, size_t l) {
+#if __AVX512BW__
+    for(; pos + 64 <= l; pos += 64) {
+        const __m512i v = _mm512_or_si512(_mm512_loadu_si512(s + pos), _mm512_set1_epi8(0x20));
+        const uint64_t notn = ~static_cast<uint64_t>(_mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('n')));
+        if(notn) return pos + __builtin_ctzll(notn);
+    }
+#elif __AVX2__
+    for(; pos + 32 <= l; pos += 32) {
+        const __m256i v = _mm256_or_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + pos)), _mm256_set1_epi8(0x20));
+        const uint32_t notn = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('n'))));
+        if(notn) return pos + __builtin_ctz(notn);
+    }
+#else
+    static constexpr uint64_t LOWER_N = 0x6e6e6e6e6e6e6e6eull, CASE_BITS = 0x2020202020202020ull;
+    for(uint64_t v; pos + 8 <= l; pos += 8) {
+        std::memcpy(&v, s + pos, sizeof(v));
+        if((v | CASE_BITS) != LOWER_N) break;
+    }
+#endif
+    while(pos < l && (s[pos] | 0x20) == 'n') ++pos;
+    return pos;
+}
+
+// As skip_n_run, but only when 'N' and 'n' are ambiguous under lut (so not for amino acid alphabets).
+static inline size_t skip_ambiguous_run(const char *s, size_t pos, size_t l, const int8_t *lut) {
+    return lut[static_cast<uint8_t>('N')] == int8_t(-1) && lut[static_cast<uint8_t>('n')] == int8_t(-1)
+        ? skip_n_run(s, pos, l): pos;
+}
+
+/*
+ * mask_low_quality copies s[0, l) to out, replacing each base whose quality character in q is below minq
+ * (Phred + 33) with maskc, 64 (AVX-512BW), 32 (AVX2) or 8 (scalar) bytes at a time.
+ * With maskc ambiguous under the encoder's alphabet, k-mers overlapping low-quality bases are skipped
+ * exactly as if those bases were N, and runs of them are jumped over by skip_n_run.
+ */
+static inline void mask_low_quality(const char *s, const char *q, size_t l, char minq, char maskc, char *out) {
+    size_t i = 0;
+#if __AVX512BW__
+    const __m512i mq = _mm512_set1_epi8(minq), mc = _mm512_set1_epi8(maskc);
+    for(; i + 64 <= l; i += 64) {
+        const __mmask64 low = _mm512_cmplt_epi8_mask(_mm512_loadu_si512(q + i), mq);
+        _mm512_storeu_si512(out + i, _mm512_mask_blend_epi8(low, _mm512_loadu_si512(s + i), mc));
+    }
+#elif __AVX2__
+    const __m256i mq = _mm256_set1_epi8(minq), mc = _mm256_set1_epi8(maskc);
+    for(; i + 32 <= l; i += 32) {
+        const __m256i low = _mm256_cmpgt_epi8(mq, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(q + i)));
+        const __m256i v = _mm256_blendv_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i)), mc, low);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), v);
+    }
+#else
+    // Without SIMD, copy eight at a time and only fix up words containing a low-quality base.
+    static constexpr uint64_t HIGH_BITS = 0x8080808080808080ull, ONES = 0x0101010101010101ull;
+    const uint64_t bias = (0x80 - static_cast<uint8_t>(minq)) * ONES;
+    for(uint64_t qw; i + 8 <= l; i += 8) {
+        std::memcpy(out + i, s + i, 8);
+        std::memcpy(&qw, q + i, 8);
+        // Bytes are below 0x80, so the high bit of qb + 0x80 - minq is set exactly when qb >= minq.
+        if(((qw + bias) & HIGH_BITS) != HIGH_BITS)
+            for(unsigned j = 0; j < 8; ++j) if(q[i + j] < minq) out[i + j] = maskc;
+    }
+#endif
+    for(; i < l; ++i) out[i] = q[i] < minq ? maskc: s[i];
+}
+
+/*
+ * QualityMask: per-encoder state for treating bases below a Phred threshold like N.
+ * apply() returns the sequence to encode: s itself if the filter is off or the record has no qualities,
+ * otherwise a masked copy held until the next call.
+ */
+class QualityMask {
+    std::string buf_;
+    char minq_ = 0; // Threshold as a quality character; 0 if off
+public:
+    static constexpr unsigned PHRED_OFFSET = 33;
+    static constexpr unsigned MAX_PHRED = 126 - PHRED_OFFSET;
+    void threshold(unsigned phred) {minq_ = phred ? static_cast<char>(phred + PHRED_OFFSET): 0;}
+    unsigned threshold() const {return minq_ ? minq_ - PHRED_OFFSET: 0;}
+    const char *apply(const char *s, const char *q, size_t l, size_t ql, const int8_t *lut) {
+        if(!minq_ || !q || ql != l) return s;
+        buf_.resize(l);
+        mask_low_quality(s, q, l, minq_, ambiguous_char(lut), &buf_[0]);
+        return buf_.data();
+    }
+    // A character which lut does not encode, preferring N so that masked runs are skipped in bulk.
+    static char ambiguous_char(const int8_t *lut) {
+        if(lut[static_cast<uint8_t>('N')] == int8_t(-1)) return 'N';
+        for(unsigned c = 1; c < 256; ++c) if(lut[c] == int8_t(-1)) return static_cast<char>(c);
+        return 0;
+    }
+};
+
+} // namespace bns
+
+#endif /* BNS_DNAPACK_H__ */
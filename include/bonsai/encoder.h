@@ -1,6 +1,8 @@
 #ifndef _EMP_ENCODER_H__
 #define _EMP_ENCODER_H__
+#include <array>
 #include <thread>
+#include <atomic>
 #include <future>
 #include <limits>
 
@@ -18,6 +20,12 @@
 #include "ntHash/nthash.hpp"
 #include "alphabet.h"
 #include "rhtraits.h"
+#include "dnapack.h"
+#include "decompress.h"
+#include "lanehash.h"
+#include "batch.h"
+#include "translate.h"
+#include "sampling.h"
 #include "sketch/hash.h"
 #include "sketch/div.h"
 #include "sketch/exception.h"
@@ -73,6 +81,26 @@ static INLINE u64 hash_score(u64 i, void *data) {
     return 0uL;
 }
 
+// Prefers members of a KmerOrderSet (eg, a universal hitting set), breaking ties by lex_score.
+static INLINE u64 set_score(u64 i, void *data) {
+    return (lex_score(i) >> 1) | (u64(!static_cast<const KmerOrderSet *>(data)->contains(i)) << 63);
+}
+
+/*
+ * FracMinHash ("scaled") sampling: with scale s, only values whose hash is at most 2^64 / s are kept,
+ * so about 1/s of distinct k-mers survive, consistently across inputs.
+ * Hash values (for_each_hash, RollingHasher, RollingHasherSet) are compared directly, by their high 64 bits
+ * if 128-bit; encoded k-mers (Encoder::for_each) are hashed with fmh_hash first.
+ */
+static inline u64 fmh_threshold(double scale) {
+    if(!(scale >= 1.)) UNRECOVERABLE_ERROR(std::string("FracMinHash scale must be at least 1, not ") + std::to_string(scale));
+    return scale == 1. ? u64(-1): static_cast<u64>(18446744073709551616. / scale);
+}
+static INLINE u64 fmh_hash(u64 x) {return __ac_Wang64_hash(x);}
+static INLINE u64 fmh_hash(u128 x) {return fold128(x);}
+static INLINE u64 fmh_value(u64 x) {return x;}
+static INLINE u64 fmh_value(u128 x) {return static_cast<u64>(x >> 64);}
+
 namespace score {
 struct Lex {
     u64 operator()(u64 i, void *data) const {return lex_score(i, data);}
@@ -86,6 +114,10 @@ struct Hash {
     u64 operator()(u64 i, void *data) const {return hash_score(i, data);}
     u128 operator()(u128 i, void *data) const {return hash_score(i, data);}
 };
+struct Set {
+    u64 operator()(u64 i, void *data) const {return set_score(i, data);}
+    u128 operator()(u128 i, void *data) const {return set_score(static_cast<u64>(i), data);} // Sets hold k <= 32
+};
 } // namespace score
 
 
@@ -120,13 +152,24 @@ public:
 private:
     u64         pos_; // Current position within the string s_ we're working with.
     void      *data_ = nullptr; // A void pointer for using with scoring. Needed for hash_score.
-    QueueMap<KmerT, KmerT> qmap_; // queue of max scores and std::map which keeps kmers, scores, and counts so that we can select the top kmer for a window.
+    QueueMap<KmerT, KmerT> qmap_; // ascending-minima deque of kmers and scores so that we can select the top kmer for a window.
     const ScoreType  scorer_; // scoring struct
     bool canonicalize_;
     InputType rht = InputType::DNA;
+    InputType frame_rht_ = InputType::PROTEIN20; // Alphabet for translated residues under PROTEIN_6_FRAME
+    Sampling sampling_ = Sampling::Minimizer;
+    unsigned sampling_m_ = 0, sampling_t_ = 0; // s-mer/t-mer length, and the open syncmer offset
+    u64 fmh_thresh_ = u64(-1); // FracMinHash threshold; -1 keeps everything
+    std::string stream_buf_; // feed(): the last c - 1 characters of the record, or all of it if !streamable()
+    QualityMask qmask_; // Masks low-quality FASTQ bases (see dnapack.h)
+    std::unique_ptr<DustWindow> dust_; // Low-complexity filter, if enabled (see entropy.h)
+    bool hpc_ = false; // Homopolymer compression
+    std::vector<u64> pos_ring_; // for_each_with_pos: starts and strands of queued k-mers (see for_each_filtered_)
+    bool streaming_ = false; // Inside a record started by feed(), so the window queue carries over
     const int8_t *lutptr = (const int8_t *)DNA4.data();
     size_t nremper = sizeof(KmerT) * 4;
     std::unique_ptr<CircusEnt> ent_tracker_;
+    SpacedGather gather_; // Built lazily from sp_ and the alphabet for rolling spaced seeds.
     static_assert(std::is_unsigned<KmerT>::value || std::is_same<KmerT, u128>::value, "Must be unsigned integers");
 
 public:
@@ -151,12 +194,13 @@ public:
     }
     Encoder(const Spacer &sp, void *data, bool canonicalize=true): Encoder(nullptr, 0, sp, data, canonicalize) {}
     Encoder(const Spacer &sp, bool canonicalize=true): Encoder(sp, nullptr, canonicalize) {}
-    Encoder(const Encoder &o): s_(o.s_), l_(o.l_), sp_(o.sp_), pos_(o.pos_), data_(o.data_), scorer_(o.scorer_), canonicalize_(o.canonicalize_), rht(o.rht) {
+    Encoder(const Encoder &o): s_(o.s_), l_(o.l_), sp_(o.sp_), pos_(o.pos_), data_(o.data_), scorer_(o.scorer_), canonicalize_(o.canonicalize_), rht(o.rht), frame_rht_(o.frame_rht_), sampling_(o.sampling_), sampling_m_(o.sampling_m_), sampling_t_(o.sampling_t_), fmh_thresh_(o.fmh_thresh_), qmask_(o.qmask_), hpc_(o.hpc_), lutptr(o.lutptr), nremper(o.nremper) {
         if(sp_.w_ > sp_.c_)
             qmap_.resize(sp_.w_ - sp_.c_ + 1);
+        if(o.dust_) dust_.reset(new DustWindow(*o.dust_));
     }
     Encoder(Encoder<ScoreType, KmerT> &&o): s_(o.s_), l_(o.l_), sp_(o.sp_), pos_(o.pos_), data_(o.data_),
-            qmap_(std::move(o.qmap_)), scorer_{}, canonicalize_(o.canonicalize_), rht(o.rht) {
+            qmap_(std::move(o.qmap_)), scorer_{}, canonicalize_(o.canonicalize_), rht(o.rht), frame_rht_(o.frame_rht_), sampling_(o.sampling_), sampling_m_(o.sampling_m_), sampling_t_(o.sampling_t_), fmh_thresh_(o.fmh_thresh_), qmask_(o.qmask_), dust_(std::move(o.dust_)), hpc_(o.hpc_), lutptr(o.lutptr), nremper(o.nremper) {
         if(o.ent_tracker_) ent_tracker_.reset(new CircusEnt(*o.ent_tracker_));
     }
     Encoder &operator=(const Encoder<ScoreType, KmerT> &o) {
@@ -166,15 +210,79 @@ public:
         data_ = o.data_;
         qmap_ = o.qmap_;
         canonicalize_ = o.canonicalize_;
-        rht = o.rht;
+        rht = o.rht; frame_rht_ = o.frame_rht_; lutptr = o.lutptr; nremper = o.nremper;
+        sampling_ = o.sampling_; sampling_m_ = o.sampling_m_; sampling_t_ = o.sampling_t_;
+        fmh_thresh_ = o.fmh_thresh_;
+        qmask_ = o.qmask_;
+        dust_.reset(o.dust_ ? new DustWindow(*o.dust_): nullptr);
+        hpc_ = o.hpc_;
         if(o.ent_tracker_) ent_tracker_.reset(new CircusEnt(std::move(*o.ent_tracker_)));
         return *this;
     }
     void hashtype(RollingHashType newrht) {
         rht = newrht; lutptr = rh2lp(rht);
-        nremper = rh2n(rht, sizeof(KmerT));
+        nremper = rh2n(rht == PROTEIN_6_FRAME ? frame_rht_: rht, sizeof(KmerT));
     }
     RollingHashType hashtype() const {return rht;}
+    // Sets the protein alphabet that residues are encoded in under PROTEIN_6_FRAME.
+    void translated_alphabet(InputType it) {
+        switch(it) {
+            case PROTEIN: case PROTEIN20: case PROTEIN_3BIT: case PROTEIN_14: case PROTEIN_6: break;
+            default: UNRECOVERABLE_ERROR(std::string("Translated alphabet must be a protein alphabet, not ") + to_string(it));
+        }
+        frame_rht_ = it;
+        if(rht == PROTEIN_6_FRAME) nremper = rh2n(it, sizeof(KmerT));
+    }
+    InputType translated_alphabet() const {return frame_rht_;}
+    /*
+     * Selects the sampling scheme (see sampling.h); m is the s-mer (syncmers) or t-mer (mod-minimizers) length,
+     * and t the offset for open syncmers. Syncmers are taken from an unwindowed Spacer,
+     * mod-minimizers from windowed ones; both need a contiguous seed over DNA.
+     */
+    void sampling(Sampling mode, unsigned m=0, unsigned t=0) {
+        if(mode != Sampling::Minimizer) {
+            if(!sp_.unspaced()) UNRECOVERABLE_ERROR(std::string(to_string(mode)) + " sampling requires a contiguous seed");
+            if(m == 0 || m > sp_.k_ || m > 32) UNRECOVERABLE_ERROR(std::string("Invalid sub-k-mer length for ") + to_string(mode) + ": " + std::to_string(m));
+            if(mode == Sampling::ModMinimizer ? sp_.unwindowed(): !sp_.unwindowed())
+                UNRECOVERABLE_ERROR(std::string(to_string(mode)) + (mode == Sampling::ModMinimizer ? " sampling requires a window": " sampling does not use a window"));
+            if(mode == Sampling::OpenSyncmer && t > sp_.k_ - m) UNRECOVERABLE_ERROR("Open syncmer offset must be at most k - s");
+        }
+        sampling_ = mode; sampling_m_ = m; sampling_t_ = t;
+    }
+    Sampling sampling() const {return sampling_;}
+    // Keeps only k-mers (or hashes, for for_each_hash) passing a FracMinHash filter with this scale; 1 disables it.
+    void scaled(double scale) {fmh_thresh_ = fmh_threshold(scale);}
+    u64 scaled_threshold() const {return fmh_thresh_;}
+    // Skips k-mers containing bases with Phred quality below phred in FASTQ records, as though they were N; 0 disables it.
+    void min_quality(unsigned phred) {
+        if(phred > QualityMask::MAX_PHRED) UNRECOVERABLE_ERROR(std::string("Phred threshold out of range: ") + std::to_string(phred));
+        qmask_.threshold(phred);
+    }
+    unsigned min_quality() const {return qmask_.threshold();}
+    /*
+     * Skips k-mers whose trailing window of w bases (including the k-mer) is low-complexity by the DUST score
+     * at this level (see DustWindow); 0 disables it. For windowed Spacers, such k-mers are never selected.
+     * This is computed in the same pass as encoding, for contiguous DNA seeds with minimizer sampling.
+     */
+    void dust(unsigned level, unsigned w=DustWindow::DEFAULT_WINDOW) {
+        if(level && (!sp_.unspaced() || w < 4)) UNRECOVERABLE_ERROR("DUST masking requires a contiguous seed and a window of at least 4 bases");
+        dust_.reset(level ? new DustWindow(level, w): nullptr);
+    }
+    unsigned dust_level() const {return dust_ ? dust_->level(): 0;}
+    /*
+     * Collapses each run of the same base (and each run of ambiguous characters) to one position before encoding,
+     * so k-mers span k distinct-base runs and homopolymer length errors in long reads don't break matches.
+     * The output matches encoding the compressed sequence; pos() still indexes the original one.
+     * As for DUST masking, this needs a contiguous DNA seed with minimizer sampling.
+     */
+    void homopolymer_compress(bool value) {
+        if(value && !sp_.unspaced()) UNRECOVERABLE_ERROR("Homopolymer compression requires a contiguous seed");
+        hpc_ = value;
+    }
+    bool homopolymer_compress() const {return hpc_;}
+    // The sequence to encode for a record, after quality masking. Valid until the next call.
+    const char *record_seq(const char *seq, const char *qual, u64 l) {return qmask_.apply(seq, qual, l, qual ? l: 0, lutptr);}
+    const char *record_seq(const kseq_t *ks) {return qmask_.apply(ks->seq.s, ks->qual.s, ks->seq.l, ks->qual.l, lutptr);}
     size_t nremperres() const {return nremper;}
     size_t nremperres64() const {return rh2n(rht, 8);}
     size_t nremperres128() const {return rh2n(rht, 16);}
@@ -200,16 +308,24 @@ public:
     // the correct portions of the structs.
     INLINE void assign(const char *s, u64 l) {
         s_ = s; l_ = l; pos_ = 0;
-        if(!sp_.unwindowed())
+        if(!sp_.unwindowed() && !streaming_)
             qmap_.reset();
         assert((l_ >= sp_.c_ || (!has_next_kmer())) || std::fprintf(stderr, "l: %zu. c: %zu. pos: %zu\n", size_t(l), size_t(sp_.c_), size_t(pos_)) == 0);
     }
     INLINE void assign(kstring_t *ks) {assign(ks->s, ks->l);}
-    INLINE void assign(kseq_t    *ks) {assign(&ks->seq);}
+    INLINE void assign(kseq_t    *ks) {assign(record_seq(ks), ks->seq.l);}
 
 
     template<typename Functor>
     INLINE void for_each_canon_windowed(const Functor &func) {
+        if(!is_entropy && rht == DNA && sp_.unspaced()) {
+            // Every position contributes to the window, with ENCODE_OVERFLOW standing in for k-mers containing ambiguous bases.
+            for_each_unspaced_dna_<true, true>([&](KmerT km) {
+                if((km = qmap_.next_value(km, scorer_(km, getdata()))) != ENCODE_OVERFLOW)
+                    func(km);
+            });
+            return;
+        }
         KmerT min;
         while(likely(has_next_kmer()))
             if((min = next_canonicalized_minimizer()) != ENCODE_OVERFLOW)
@@ -217,33 +333,353 @@ public:
     }
     template<typename Functor>
     INLINE void for_each_canon_unwindowed(const Functor &func) {
-        auto ffunc = [k=sp_.k_,rht=this->rht,&func](KmerT min) {
-            if(rht == DNA) min = canonical_representation(min, k);
-            return func(min);
-        };
         if(sp_.unspaced()) {
-            for_each_uncanon_unspaced_unwindowed(ffunc);
+            if(rht == DNA) for_each_unspaced_dna_<true, false>(func);
+            else           for_each_uncanon_unspaced_unwindowed_scalar(func);
         } else {
             KmerT min;
             while(likely(has_next_kmer()))
                 if((min = next_kmer()) != ENCODE_OVERFLOW)
-                    ffunc(min);
+                    func(rht == DNA ? canonical_representation(min, sp_.k_): min);
         }
     }
     template<typename Functor>
     INLINE void for_each_uncanon_spaced(const Functor &func) {
+        if(!is_entropy) {
+            const unsigned nb = spaced_nbits();
+            if(SpacedGather::usable(sp_, nb)) {
+                if(!gather_.matches(sp_, nb)) gather_ = SpacedGather(sp_, nb);
+                if(sp_.c_ * nb <= 64) for_each_spaced_rolling_<u64>(func);
+                else                  for_each_spaced_rolling_<u128>(func);
+                return;
+            }
+        }
         KmerT min;
         while(likely(has_next_kmer()))
             if((min = next_minimizer()) != ENCODE_OVERFLOW)
                 func(min);
     }
+    // Bits per character for alphabets packed by shifting in kmer(), 0 otherwise.
+    unsigned spaced_nbits() const {
+        switch(rht) {
+            case DNA: return 2;
+            case DNA2: case DNAC: return 1;
+            case PROTEIN_3BIT: return 3;
+            case PROTEIN: return 8;
+            default: return 0;
+        }
+    }
+    template<typename WindowT, typename Functor>
+    INLINE void for_each_spaced_rolling_(const Functor &func) {
+        // Keeps the last c characters packed in one register, most recent lowest,
+        // and extracts each spaced k-mer with gather_ (PEXT with BMI2, one shift/mask per contiguous run otherwise).
+        // Ambiguous characters are tracked in a parallel bitmask, so only those falling on selected
+        // positions of the seed invalidate a k-mer, matching kmer().
+        // pos_ is start + 1 during the callback, as in next_minimizer().
+        const unsigned nb = gather_.nbits_, c = sp_.c_;
+        const WindowT winmask = static_cast<WindowT>(gather_.winmask_);
+        const u64 charmask = gather_.charmask_;
+        const bool windowed = !sp_.unwindowed();
+        WindowT window = 0;
+        u64 badwin = 0;
+        for(u64 i = pos_, beg = pos_; i < l_; ++i) {
+            const int8_t nv = lutptr[static_cast<uint8_t>(s_[i])];
+            const bool bad = nv == int8_t(-1);
+            window = ((window << nb) | static_cast<WindowT>(bad ? 0: static_cast<uint8_t>(nv))) & winmask;
+            badwin = (badwin << 1) | bad;
+            if(i + 1 < beg + c) continue;
+            pos_ = i - c + 2;
+            if(windowed) {
+                KmerT km = badwin & charmask ? ENCODE_OVERFLOW: gather_.extract<KmerT>(window);
+                if((km = qmap_.next_value(km, scorer_(km, getdata()))) != ENCODE_OVERFLOW)
+                    func(km);
+            } else if(!(badwin & charmask)) {
+                func(gather_.extract<KmerT>(window));
+            }
+        }
+        if(l_ >= c) pos_ = l_ - c + 1;
+    }
+    template<typename Functor>
+    INLINE void for_each_sampled_(const Functor &func) {
+        // Syncmers and mod-minimizers over DNA.
+        // Rolls the k-mer and the m-mer (s- or t-mer) together with their reverse complements,
+        // and QueueMap tracks the start of the best m-mer (leftmost on ties) over the m-mers of each window.
+        // For mod-minimizers, the last w k-mers are kept in a ring so the selected one can be emitted.
+        // pos_ is start + k of the last k-mer in the window during the callback.
+        if(rht != DNA) UNRECOVERABLE_ERROR(std::string(to_string(sampling_)) + " sampling requires DNA");
+        const bool modmin = sampling_ == Sampling::ModMinimizer, closed = sampling_ == Sampling::ClosedSyncmer;
+        const unsigned k = sp_.k_, m = sampling_m_;
+        const u64 w = modmin ? sp_.w_ - k + 1: 1, span = w + k - 1;
+        const KmerT kmask = rhmask<KmerT>(DNA, k);
+        const u64 mmask = rhmask<u64>(DNA, m);
+        const unsigned krcshift = (k - 1) * 2, mrcshift = (m - 1) * 2;
+        QueueMap<u64, u64> mins(span - m + 1);
+        std::vector<KmerT> ring(modmin ? w: 0);
+        KmerT fk = 0, rk = 0;
+        u64 fm = 0, rm = 0, filled = 0;
+        for(u64 i = pos_; i < l_; ++i) {
+            const int8_t c = lutptr[static_cast<uint8_t>(s_[i])];
+            if(c == int8_t(-1)) {
+                filled = 0;
+                mins.reset();
+                i = skip_ambiguous_run(s_, i + 1, l_, lutptr) - 1;
+                continue;
+            }
+            fk = ((fk << 2) | KmerT(c)) & kmask;
+            rk = (rk >> 2) | (KmerT(c ^ 3) << krcshift);
+            fm = ((fm << 2) | u64(c)) & mmask;
+            rm = (rm >> 2) | (u64(c ^ 3) << mrcshift);
+            ++filled;
+            if(modmin && filled >= k) ring[(i + 1 - k) % w] = canonicalize_ ? std::min(fk, rk): fk;
+            if(filled < m) continue;
+            const u64 best = mins.next_value(i + 1 - m, lex_score(canonicalize_ ? std::min(fm, rm): fm));
+            if(filled < span) continue;
+            const u64 r = best - (i + 1 - span); // Offset of the best m-mer within the window
+            pos_ = i + 1;
+            if(modmin) func(ring[(i + 1 - span + r % w) % w]);
+            else if(closed ? (r == 0 || r == k - m): r == sampling_t_)
+                func(canonicalize_ ? std::min(fk, rk): fk);
+        }
+        pos_ = l_;
+    }
+    template<typename Functor>
+    INLINE void for_each_six_frame_(const Functor &func) {
+        // Decodes each base once (64 at a time, see dnapack.h) and rolls all six frames' k-mers together.
+        // Each codon's residue on either strand comes from a 64-entry CodonTable in the translated alphabet.
+        // Forward-frame k-mers roll as in for_each_uncanon_unspaced_unwindowed_scalar.
+        // Reverse-frame k-mers read right to left, so the new residue enters at the top
+        // and the oldest leaves from the bottom via an exact division by the alphabet size.
+        // func(kmer, frame) numbers frames as translate_frame does; pos_ is one past the last base consumed.
+        if(!sp_.unspaced() || !sp_.unwindowed() || is_entropy)
+            UNRECOVERABLE_ERROR("PROTEIN_6_FRAME encoding supports only contiguous, unwindowed seeds without entropy scoring");
+        const CodonTable ct(rh2lp(frame_rht_));
+        const KmerT mul = bns::mul(frame_rht_);
+        const ExactDivider<KmerT> div(mul);
+        const unsigned k = sp_.k_;
+        KmerT top = 1;
+        for(unsigned i = 1; i < k; ++i) top *= mul;
+        struct FrameState {
+            KmerT fk = 0, rk = 0;
+            unsigned ffill = 0, rfill = 0, head = 0;
+        } st[3];
+        std::vector<uint8_t> ring(3 * k); // The last k codons of each frame
+        unsigned codon = 0, nvalid = 0;
+        u64 i = pos_;
+        auto eat = [&](int8_t nt) {
+            if(nt < 0) nvalid = 0;
+            else       codon = ((codon << 2) | nt) & 63u, ++nvalid;
+            if(i >= 2) {
+                const unsigned f = (i + 1) % 3; // == (i - 2) % 3
+                FrameState &fs = st[f];
+                uint8_t &slot = ring[f * k + fs.head];
+                const int8_t fc = nvalid >= 3 ? ct.fwd[codon]: int8_t(-1), rc = nvalid >= 3 ? ct.rev[codon]: int8_t(-1);
+                if(fc < 0) fs.fk = fs.ffill = 0;
+                else {
+                    if(fs.ffill == k) fs.fk -= top * KmerT(ct.fwd[slot]);
+                    else              ++fs.ffill;
+                    fs.fk = fs.fk * mul + KmerT(fc);
+                }
+                if(rc < 0) fs.rk = fs.rfill = 0;
+                else {
+                    // The lowest digit is zero until the window fills.
+                    const KmerT low = fs.rfill == k ? KmerT(ct.rev[slot]): KmerT(0);
+                    if(fs.rfill < k) ++fs.rfill;
+                    fs.rk = div(fs.rk - low) + top * KmerT(rc);
+                }
+                slot = codon;
+                if(++fs.head == k) fs.head = 0;
+                pos_ = i + 1;
+                if(fs.ffill == k) func(fs.fk, f);
+                if(fs.rfill == k) func(fs.rk, 3 + (l_ - 1 - i) % 3);
+            }
+            ++i;
+        };
+        PackedDNABlock blk;
+        while(i + PackedDNABlock::BLOCK_SIZE <= l_) {
+            pack_dna64(s_ + i, blk);
+            for(unsigned j = 0; j < 2; ++j) {
+                uint64_t w = blk.w[j];
+                uint32_t bad = blk.bad >> (j * 32);
+                for(unsigned b = 0; b < 32; ++b, w >>= 2, bad >>= 1)
+                    eat(unlikely(bad & 1u) ? lutptr[static_cast<uint8_t>(s_[i])]: int8_t(w & 3u));
+            }
+        }
+        while(i < l_) eat(lutptr[static_cast<uint8_t>(s_[i])]);
+        pos_ = l_;
+    }
     template<typename Functor>
     INLINE void for_each_uncanon_unspaced_unwindowed(const Functor &func) {
+        if(rht == DNA) for_each_unspaced_dna_<false, false>(func);
+        else           for_each_uncanon_unspaced_unwindowed_scalar(func);
+    }
+    // Specializations for the k most commonly used, so masks and shifts are compile-time constants.
+    // Windowed encoding (signal_invalid) is bound by the QueueMap, so it keeps the one generic copy.
+    template<bool canon, bool signal_invalid, typename Functor>
+    INLINE void for_each_unspaced_dna_(const Functor &func) {
+        CONST_IF(signal_invalid) {
+            unspaced_dna_kernel_<canon, signal_invalid, 0>(func);
+            return;
+        }
+        switch(sp_.k_) {
+            case 15: unspaced_dna_kernel_<canon, signal_invalid, 15>(func); break;
+            case 21: unspaced_dna_kernel_<canon, signal_invalid, 21>(func); break;
+            case 25: unspaced_dna_kernel_<canon, signal_invalid, 25>(func); break;
+            case 31: unspaced_dna_kernel_<canon, signal_invalid, 31>(func); break;
+            default: unspaced_dna_kernel_<canon, signal_invalid, 0>(func);
+        }
+    }
+    /*
+     * for_each_ with DUST masking and/or homopolymer compression, for contiguous DNA seeds: a scalar loop rolling
+     * the k-mer, its reverse complement and dust_ together, kept out of line so the kernels without them are unaffected.
+     * As in those kernels, pos_ is one past the k-mer's last base during the callback. Canonical windowed encoding gives
+     * every k-mer start a queue slot, with ENCODE_OVERFLOW for invalid or masked k-mers;
+     * uncanonical windowed encoding leaves them out of the queue.
+     * Under homopolymer compression, positions are counted after compression, so the output matches
+     * encoding the compressed sequence (see homopolymer_compress).
+     * With with_pos, func is called as func(kmer, start, rc) (see for_each_with_pos). Each window slot's start and strand
+     * are kept in pos_ring_ by its index in qmap_, so the selected minimizer's are looked up from the queue's front.
+     */
+    template<bool with_pos, typename Functor>
+    __attribute__((noinline)) void for_each_filtered_(const Functor &func) {
+        const unsigned k = sp_.k_, rcshift = (k - 1) * 2;
+        const KmerT mask = rhmask<KmerT>(DNA, k);
+        const bool windowed = !sp_.unwindowed(), canon = canonicalize_, slots = windowed && canon, hpc = hpc_;
+        DustWindow *const dw = dust_.get();
+        KmerT fk = 0, rk = 0, kmer;
+        unsigned filled = 0;
+        int8_t last = -1;
+        u64 npos = 0; // Positions consumed in the (compressed) sequence
+        // with_pos: pos_ring_ holds window slots' (start << 1) | rc in [0, smask], then,
+        // under compression, the index in s_ of each of the last k compressed bases in [smask + 1, smask + 1 + bmask].
+        u64 smask = 0, bmask = 0, *slotpos = nullptr, *basepos = nullptr;
+        CONST_IF(with_pos) {
+            smask = windowed ? roundup64(qmap_.size() + 1) - 1: 0;
+            bmask = hpc ? roundup64(k) - 1: 0;
+            if(pos_ring_.size() < smask + bmask + 2) pos_ring_.resize(smask + bmask + 2);
+            slotpos = pos_ring_.data();
+            basepos = slotpos + smask + 1;
+        }
+        auto call = [&](KmerT km, u64 info) {
+            CONST_IF(with_pos) func(km, info >> 1, bool(info & 1));
+            else               func(km);
+        };
+        auto emit = [&](KmerT km, u64 info) {
+            if(!windowed) call(km, info);
+            else {
+                CONST_IF(with_pos) slotpos[qmap_.n_added() & smask] = info;
+                if((kmer = qmap_.next_value(km, scorer_(km, getdata()))) != ENCODE_OVERFLOW)
+                    call(kmer, with_pos ? slotpos[qmap_.max_index() & smask]: u64(0));
+            }
+        };
+        if(dw) dw->clear();
+        while(pos_ < l_) {
+            const int8_t c = lutptr[static_cast<uint8_t>(s_[pos_++])];
+            if(c == int8_t(-1)) {
+                fk = rk = filled = 0;
+                last = -1;
+                if(dw) dw->clear();
+                u64 next = skip_ambiguous_run(s_, pos_, l_, lutptr);
+                // A run of ambiguous characters compresses to one position.
+                if(hpc) while(next < l_ && lutptr[static_cast<uint8_t>(s_[next])] == int8_t(-1)) next = skip_ambiguous_run(s_, next + 1, l_, lutptr);
+                for(const u64 e = npos + (hpc ? 1: next - pos_ + 1); npos < e;)
+                    if(++npos >= k && slots) emit(ENCODE_OVERFLOW, 0);
+                pos_ = next;
+                continue;
+            }
+            if(hpc) {
+                if(c == last) continue;
+                last = c;
+                CONST_IF(with_pos) basepos[npos & bmask] = pos_ - 1;
+            }
+            ++npos;
+            fk = (fk << 2) | KmerT(c);
+            rk = (rk >> 2) | (KmerT(c ^ 3) << rcshift);
+            if(dw) dw->push(c);
+            if(filled < k) ++filled;
+            if(filled == k) {
+                if(!dw || !dw->low_complexity()) {
+                    const KmerT f = fk & mask;
+                    const bool rc = canon && rk < f;
+                    emit(rc ? rk: f, with_pos ? ((hpc ? basepos[(npos - k) & bmask]: pos_ - k) << 1) | rc: u64(0));
+                } else if(slots) emit(ENCODE_OVERFLOW, 0);
+            } else if(slots && npos >= k) emit(ENCODE_OVERFLOW, 0);
+        }
+        if(windowed && !canon && qmap_.partially_full() && !streaming_)
+            call(qmap_.max_in_queue().el_, with_pos ? slotpos[qmap_.max_index() & smask]: u64(0));
+    }
+    template<bool canon, bool signal_invalid, unsigned FixedK, typename Functor>
+    INLINE void unspaced_dna_kernel_(const Functor &func) {
+        // Packs 64 characters at a time (see dnapack.h) and rolls k-mers from the packed words.
+        // Bytes flagged by the packer which are nonetheless valid under lutptr are handled per-character,
+        // so the output is identical to for_each_uncanon_unspaced_unwindowed_scalar.
+        // If canon, the reverse complement is kept in a second register (one shift and one OR per base)
+        // and the lesser of the two is emitted.
+        // If signal_invalid, ENCODE_OVERFLOW is emitted for each k-mer containing an ambiguous base,
+        // so that exactly one value is emitted per k-mer start position.
+        // FixedK, if non-zero, is sp_.k_.
+        const unsigned k = FixedK ? FixedK: sp_.k_, rcshift = (k - 1) * 2;
+        const KmerT mask = FixedK ? KmerT((KmerT(1) << (2 * FixedK)) - 1): rhmask<KmerT>(rht, sp_.k_);
+        KmerT min = 0, rcmin = 0;
+        unsigned filled = 0;
+        auto eat = [&](KmerT c) {
+            min = (min << 2) | c;
+            CONST_IF(canon) rcmin = (rcmin >> 2) | ((c ^ 3u) << rcshift);
+            ++pos_;
+            if(++filled == k) {
+                CONST_IF(canon) func(std::min(KmerT(min & mask), rcmin));
+                else            func(KmerT(min & mask));
+                --filled;
+            } else CONST_IF(signal_invalid) {
+                if(pos_ >= k) func(ENCODE_OVERFLOW);
+            }
+        };
+        auto reset = [&]() {
+            min = rcmin = filled = 0;
+            ++pos_;
+            CONST_IF(signal_invalid) {
+                if(pos_ >= k) func(ENCODE_OVERFLOW);
+            }
+            // Jump over any run of N which follows.
+            const u64 next = skip_ambiguous_run(s_, pos_, l_, lutptr);
+            CONST_IF(signal_invalid) {
+                while(pos_ < next)
+                    if(++pos_ >= k) func(ENCODE_OVERFLOW);
+            } else pos_ = next;
+        };
+        PackedDNABlock blk;
+        for(;pos_ + PackedDNABlock::BLOCK_SIZE <= l_;) {
+            pack_dna64(s_ + pos_, blk);
+            for(unsigned j = 0; j < 2; ++j) {
+                uint64_t w = blk.w[j];
+                uint32_t bad = blk.bad >> (j * 32);
+                for(unsigned i = 0; i < 32; ++i, w >>= 2, bad >>= 1) {
+                    if(unlikely(bad & 1u)) {
+                        const int8_t nv = lutptr[static_cast<uint8_t>(s_[pos_])];
+                        if(nv == int8_t(-1)) {
+                            reset();
+                            goto next_block; // Repack from wherever the N run ended
+                        } else eat(KmerT(nv));
+                    } else eat(KmerT(w & 3u));
+                }
+            }
+            next_block:;
+        }
+        while(pos_ < l_) {
+            const int8_t nv = lutptr[static_cast<uint8_t>(s_[pos_])];
+            if(nv == int8_t(-1)) reset();
+            else                 eat(KmerT(nv));
+        }
+    }
+    template<typename Functor>
+    INLINE void for_each_uncanon_unspaced_unwindowed_scalar(const Functor &func) {
+        if(for_each_protein20_fixed_<false>(func)) return;
         const KmerT mask(rhmask<KmerT>(rht, sp_.k_));
         schism::Schismatic<std::conditional_t<(sizeof(KmerT) <= 8), KmerT, uint64_t>> div(mask);
         KmerT min;
         unsigned filled;
         const size_t mul = rhmul();
+        const bool radix = mixed_radix();
+        const auto drop = radix_drop_table();
         loop_start:
         min = filled = 0;
         while(likely(pos_ < l_)) {
@@ -251,11 +687,17 @@ public:
                 const char c_at_pos = s_[pos_];
                 const int8_t nv = lutptr[c_at_pos];
                 ++pos_;
-                if(nv == int8_t(-1)) {min = ENCODE_OVERFLOW; goto loop_start;}
-                min = (min * mul) | nv;
+                if(nv == int8_t(-1)) {min = ENCODE_OVERFLOW; pos_ = skip_ambiguous_run(s_, pos_, l_, lutptr); goto loop_start;}
+                min = radix ? KmerT(min * mul + nv): KmerT((min * mul) | nv);
                 ++filled;
             }
             if(likely(filled == sp_.k_)) {
+                if(radix) {
+                    func(min);
+                    min -= drop[lutptr[s_[pos_ - sp_.k_]]];
+                    --filled;
+                    continue;
+                }
                 if(rht == DNA || rht == DNA2 || rht == PROTEIN_3BIT) min &= mask;
                 else {
                     assert(div.mod(min) == min % mask);
@@ -272,22 +714,33 @@ public:
     }
     template<typename Functor>
     INLINE void for_each_uncanon_unspaced_windowed(const Functor &func) {
+        if(for_each_protein20_fixed_<true>(func)) return;
         const KmerT mask(rhmask<KmerT>(rht, sp_.k_));
         schism::Schismatic<std::conditional_t<(sizeof(KmerT) <= 8), KmerT, uint64_t>> div(mask);
         KmerT min, kmer;
         unsigned filled;
         const size_t mul = rhmul();
+        const bool radix = mixed_radix();
+        const auto drop = radix_drop_table();
         windowed_loop_start:
         min = filled = 0;
         while(likely(pos_ < l_)) {
             while(filled < sp_.k_ && likely(pos_ < l_)) {
-                min *= mul;
-                if(unlikely((min |= lutptr[s_[pos_++]]) == ENCODE_OVERFLOW) && likely(sp_.k_ < sizeof(KmerT) * 4 || lutptr[s_[pos_ - 1]] != 'T')) {
+                const int8_t nv = lutptr[s_[pos_++]];
+                if(unlikely(nv == int8_t(-1))) {
+                    pos_ = skip_ambiguous_run(s_, pos_, l_, lutptr);
                     goto windowed_loop_start;
                 }
+                min = radix ? KmerT(min * mul + nv): KmerT((min * mul) | nv);
                 ++filled;
             }
             if(likely(filled == sp_.k_)) {
+                if(radix) {
+                    if((kmer = qmap_.next_value(min, scorer_(min, getdata()))) != ENCODE_OVERFLOW) func(kmer);
+                    min -= drop[lutptr[s_[pos_ - sp_.k_]]];
+                    --filled;
+                    continue;
+                }
                 if(rht == DNA || rht == DNA2 || rht == PROTEIN_3BIT) min &= mask;
                 else {
                     assert(div.mod(min) == min % mask);
@@ -301,9 +754,56 @@ public:
                 --filled;
             }
         }
-        if(qmap_.partially_full())
+        if(qmap_.partially_full() && !streaming_)
             func(qmap_.max_in_queue().el_);
     }
+    // PROTEIN20 specializations for common protein k, returning false if there is none for this Encoder.
+    template<bool windowed, typename Functor>
+    INLINE bool for_each_protein20_fixed_(const Functor &func) {
+        if(rht != PROTEIN20) return false;
+        switch(sp_.k_) {
+            case 7:  protein20_kernel_<7,  windowed>(func); return true;
+            case 9:  protein20_kernel_<9,  windowed>(func); return true;
+            case 10: protein20_kernel_<10, windowed>(func); return true;
+            case 12: protein20_kernel_<12, windowed>(func); return true;
+        }
+        return false;
+    }
+    template<unsigned K>
+    static constexpr std::array<KmerT, 20> protein20_drop_table_() {
+        std::array<KmerT, 20> ret{};
+        KmerT top = 1;
+        for(unsigned i = 1; i < K; ++i) top *= 20;
+        for(unsigned c = 0; c < 20; ++c) ret[c] = top * c;
+        return ret;
+    }
+    template<unsigned K, bool windowed, typename Functor>
+    INLINE void protein20_kernel_(const Functor &func) {
+        // for_each_uncanon_unspaced_(un)windowed with the radix, k and drop table as constants.
+        static_assert(K <= 14 || sizeof(KmerT) > 8, "PROTEIN20 k-mers must fit in KmerT");
+        static constexpr std::array<KmerT, 20> drop = protein20_drop_table_<K>();
+        KmerT min = 0, kmer;
+        unsigned filled = 0;
+        while(likely(pos_ < l_)) {
+            const int8_t nv = lutptr[static_cast<uint8_t>(s_[pos_++])];
+            if(unlikely(nv == int8_t(-1))) {
+                min = filled = 0;
+                continue;
+            }
+            min = min * 20 + KmerT(nv);
+            if(++filled == K) {
+                CONST_IF(windowed) {
+                    if((kmer = qmap_.next_value(min, scorer_(min, getdata()))) != ENCODE_OVERFLOW) func(kmer);
+                } else func(min);
+                min -= drop[lutptr[static_cast<uint8_t>(s_[pos_ - K])]];
+                --filled;
+            }
+        }
+        CONST_IF(windowed) {
+            if(qmap_.partially_full() && !streaming_)
+                func(qmap_.max_in_queue().el_);
+        }
+    }
     template<typename Functor>
     INLINE void for_each_uncanon_unspaced_windowed_entropy_(const Functor &func) {
         // NEVER CALL THIS DIRECTLY.
@@ -315,6 +815,8 @@ public:
         if(!ent_tracker_)
             ent_tracker_.reset(new CircusEnt(this->k()));
         CircusEnt &ent = *ent_tracker_;
+        const bool radix = mixed_radix();
+        const auto drop = radix_drop_table();
         windowed_loop_start:
         ent.clear();
         const size_t mul = rhmul();
@@ -322,12 +824,18 @@ public:
         while(likely(pos_ < l_)) {
             while(filled < sp_.k_ && likely(pos_ < l_)) {
                 const auto nc = lutptr[s_[pos_++]];
-                if(nc == int8_t(-1)) {min = ENCODE_OVERFLOW; goto windowed_loop_start;}
-                min = (mul * min) | nc;
+                if(nc == int8_t(-1)) {min = ENCODE_OVERFLOW; pos_ = skip_ambiguous_run(s_, pos_, l_, lutptr); goto windowed_loop_start;}
+                min = radix ? KmerT(mul * min + nc): KmerT((mul * min) | nc);
                 ent.push(nc);
                 ++filled;
             }
             if(likely(filled == sp_.k_)) {
+                if(radix) {
+                    if((kmer = qmap_.next_value(min, min / (ent.value() + .001))) != ENCODE_OVERFLOW) func(kmer);
+                    min -= drop[lutptr[s_[pos_ - sp_.k_]]];
+                    --filled;
+                    continue;
+                }
                 if(rht == DNA || rht == DNA2 || rht == PROTEIN_3BIT) min &= mask;
                 else {
                     CONST_IF(sizeof(KmerT) <= 8) {
@@ -341,7 +849,7 @@ public:
                 --filled;
             }
         }
-        if(qmap_.partially_full())
+        if(qmap_.partially_full() && !streaming_)
             func(max_in_queue().el_);
     }
     template<typename Functor>
@@ -359,6 +867,13 @@ public:
     }
     template<typename Functor>
     INLINE void for_each_hash(const Functor &func, unsigned k = 0) const {
+        if(fmh_thresh_ != u64(-1)) {
+            const u64 thresh = fmh_thresh_;
+            for_each_hash_([&func,thresh](u64 h) {if(h <= thresh) func(h);}, k);
+        } else for_each_hash_(func, k);
+    }
+    template<typename Functor>
+    INLINE void for_each_hash_(const Functor &func, unsigned k) const {
         k = k > 0 ? k: sp_.k_;
         if(!sp_.unwindowed()) UNRECOVERABLE_ERROR("Can't for_each_hash for a windowed spacer");
         if(!sp_.unspaced()) UNRECOVERABLE_ERROR("Can't for_each_hash for a spaced spacer");
@@ -368,7 +883,7 @@ public:
         const char *p, *p2;
 
         start:
-        p = s_ + i;
+        p = s_ + skip_ambiguous_run(s_, i, l_, cstr_lut);
         while(*p && cstr_lut[*p] < 0) ++p;
         for(;;) {
             p2 = p;
@@ -394,7 +909,7 @@ public:
     }
     template<typename Functor>
     INLINE void for_each_hash(const Functor &func, kseq_t *ks) {
-        while(kseq_read(ks) >= 0) assign(ks), for_each_hash<Functor>(func, ks->seq.s, ks->seq.l);
+        while(kseq_read(ks) >= 0) for_each_hash<Functor>(func, record_seq(ks), ks->seq.l);
     }
     template<typename Functor>
     void for_each_hash(const Functor &func, gzFile fp, kseq_t *ks=nullptr) {
@@ -406,16 +921,61 @@ public:
     }
     template<typename Functor>
     void for_each_hash(const Functor &func, const char *path, kseq_t *ks=nullptr) {
-        gzFile fp(gzopen(path, "rb"));
-        if(!fp) UNRECOVERABLE_ERROR(ks::sprintf("Could not open file at %s. Abort!\n", path).data());
-        gzbuffer(fp, 1<<18);
-        for_each_hash<Functor>(func, fp, ks);
-        gzclose(fp);
+        if(!with_gzfile(path, [&](gzFile fp) {for_each_hash<Functor>(func, fp, ks);}))
+            UNRECOVERABLE_ERROR(ks::sprintf("Could not open file at %s. Abort!\n", path).data());
     }
     template<typename Functor>
     INLINE void for_each(const Functor &func, const char *str, u64 l) {
+        if(fmh_thresh_ != u64(-1)) {
+            const u64 thresh = fmh_thresh_;
+            for_each_<>([&func,thresh](KmerT km) {if(fmh_hash(km) <= thresh) func(km);}, str, l);
+        } else for_each_<Functor>(func, str, l);
+    }
+    /*
+     * As for_each, calling func(kmer, start, rc) with the offset in str of the k-mer's first base
+     * and whether kmer is the reverse complement of the sequence there (only when canonicalizing).
+     * For windowed Spacers, these locate the selected minimizer.
+     * Contiguous DNA seeds with minimizer sampling track them inside the encoding loop (see for_each_filtered_).
+     * Other configurations take start from pos() during for_each, as encode_chunk_ does, and report rc as false.
+     * That start is exact for unwindowed seeds; for windowed ones, it is that of the window's last k-mer.
+     */
+    template<typename Functor>
+    void for_each_with_pos(const Functor &func, const char *str, u64 l) {
+        if(fmh_thresh_ != u64(-1)) {
+            const u64 thresh = fmh_thresh_;
+            for_each_with_pos_([&func,thresh](KmerT km, u64 start, bool rc) {if(fmh_hash(km) <= thresh) func(km, start, rc);}, str, l);
+        } else for_each_with_pos_<Functor>(func, str, l);
+    }
+    template<typename Functor>
+    void for_each_with_pos_(const Functor &func, const char *str, u64 l) {
+        if(rht == DNA && sp_.unspaced() && sampling_ == Sampling::Minimizer && !is_entropy) {
+            this->assign(str, l);
+            if(has_next_kmer()) for_each_filtered_<true>(func);
+            return;
+        }
+        // As in encode_chunk_, pos() is start + k for unspaced seeds and start + 1 for spaced seeds during the callback;
+        // six-frame k-mers span 3k bases.
+        const u64 off = rht == PROTEIN_6_FRAME ? 3 * sp_.k_: sp_.unspaced() ? sp_.k_: 1;
+        for_each_([&](KmerT km) {func(km, pos_ - off, false);}, str, l);
+    }
+    template<typename Functor>
+    INLINE void for_each_(const Functor &func, const char *str, u64 l) {
         this->assign(str, l);
         if(!has_next_kmer()) return;
+        if(rht == PROTEIN_6_FRAME) {
+            for_each_six_frame_([&](KmerT km, unsigned) {func(km);});
+            return;
+        }
+        if(unlikely(dust_ != nullptr || hpc_)) {
+            if(rht != DNA || sampling_ != Sampling::Minimizer || is_entropy || !sp_.unspaced())
+                UNRECOVERABLE_ERROR("DUST masking and homopolymer compression require DNA input, a contiguous seed, minimizer sampling and a non-entropy score");
+            for_each_filtered_<false>(func);
+            return;
+        }
+        if(sampling_ != Sampling::Minimizer) {
+            for_each_sampled_(func);
+            return;
+        }
         if(rht != DNA && canonicalize_) {canonicalize_ = false;}
         if(canonicalize_) {
             if(sp_.unwindowed()) {
@@ -435,14 +995,29 @@ public:
                     else for_each_uncanon_unspaced_windowed(func);
                 }
             } else {
-                if(canonicalize_) for_each_uncanon_spaced(func);
-                //else              for_each_canon_spaced(func); Unless the spaced seed is symmetric, we can't do this
+                for_each_uncanon_spaced(func);
+                // Canonicalization is disabled for spaced seeds: unless the seed is symmetric, we can't do this
             }
         }
     }
+    // As for_each under PROTEIN_6_FRAME, but calls func(kmer, frame), where frames 0-2 are forward and 3-5 reverse.
+    template<typename Functor>
+    void for_each_frame(const Functor &func, const char *str, u64 l) {
+        if(rht != PROTEIN_6_FRAME) UNRECOVERABLE_ERROR("for_each_frame requires PROTEIN_6_FRAME");
+        this->assign(str, l);
+        if(!has_next_kmer()) return;
+        if(fmh_thresh_ != u64(-1)) {
+            const u64 thresh = fmh_thresh_;
+            for_each_six_frame_([&func,thresh](KmerT km, unsigned f) {if(fmh_hash(km) <= thresh) func(km, f);});
+        } else for_each_six_frame_(func);
+    }
+    template<typename Functor>
+    void for_each_frame(const Functor &func, kseq_t *ks) {
+        while(kseq_read(ks) >= 0) for_each_frame<Functor>(func, record_seq(ks), ks->seq.l);
+    }
     template<typename Functor>
     INLINE void for_each(const Functor &func, kseq_t *ks) {
-        while(kseq_read(ks) >= 0) assign(ks), for_each<Functor>(func, ks->seq.s, ks->seq.l);
+        while(kseq_read(ks) >= 0) for_each<Functor>(func, record_seq(ks), ks->seq.l);
     }
     template<typename Functor>
     INLINE void for_each_canon(const Functor &func, kseq_t *ks) {
@@ -480,27 +1055,20 @@ public:
     }
     template<typename Functor>
     INLINE void for_each_canon(const Functor &func, const char *path, kseq_t *ks=nullptr) {
-        gzFile fp(gzopen(path, "rb"));
-        if(!fp) UNRECOVERABLE_ERROR(ks::sprintf("Could not open file at %s. Abort!\n", path).data());
-        gzbuffer(fp, 1<<18);
-        for_each_canon<Functor>(func, fp, ks);
-        gzclose(fp);
+        if(!with_gzfile(path, [&](gzFile fp) {for_each_canon<Functor>(func, fp, ks);}))
+            UNRECOVERABLE_ERROR(ks::sprintf("Could not open file at %s. Abort!\n", path).data());
     }
     template<typename Functor>
     INLINE void for_each_uncanon(const Functor &func, const char *path, kseq_t *ks=nullptr) {
-        gzFile fp(gzopen(path, "rb"));
-        if(!fp) UNRECOVERABLE_ERROR(ks::sprintf("Could not open file at %s. Abort!\n", path).data());
-        gzbuffer(fp, 1<<18);
-        for_each_uncanon<Functor>(func, fp, ks);
-        gzclose(fp);
+        if(!with_gzfile(path, [&](gzFile fp) {for_each_uncanon<Functor>(func, fp, ks);}))
+            UNRECOVERABLE_ERROR(ks::sprintf("Could not open file at %s. Abort!\n", path).data());
     }
     template<typename Functor>
     INLINE void for_each(const Functor &func, gzFile fp, kseq_t *ks=nullptr) {
         bool destroy;
         if(ks == nullptr) ks = kseq_init(fp), destroy = true;
         else            kseq_assign(ks, fp), destroy = false;
-        if(canonicalize_) for_each_canon<Functor>(func, ks);
-        else              for_each_uncanon<Functor>(func, ks);
+        for_each<Functor>(func, ks); // Per record, so scaled, sampled and six-frame modes apply to files too
         if(destroy) kseq_destroy(ks);
     }
     template<typename Functor>
@@ -509,24 +1077,8 @@ public:
     }
     template<typename Functor>
     void for_each(const Functor &func, const char *path, kseq_t *ks=nullptr) {
-        const size_t pl = std::strlen(path);
-        std::FILE *pfp = 0;
-        gzFile fp = 0;
-        bool matchxz = pl >= 3 && std::equal(&path[pl - 3], &path[pl], ".xz");
-        bool matchbz = pl >= 4 && std::equal(&path[pl - 4], &path[pl], ".bz2");
-        bool matchzst = pl >= 4 && std::equal(&path[pl - 4], &path[pl], ".zst");
-        if(matchxz || matchbz || matchzst) {
-            std::string cmd = std::string(matchxz ? "xz": (matchbz ? "bzip2": "zstd")) + " -dc " + path;
-            pfp = ::popen(cmd.data(), "r");
-            if(!pfp) UNRECOVERABLE_ERROR(std::string("Failed to open popen call: ") + cmd);
-            fp = gzdopen(::fileno(pfp), "rb");
-        } else fp = gzopen(path, "rb");
-        if(!fp) UNRECOVERABLE_ERROR(ks::sprintf("Could not open file at %s. Abort!\n", path).data());
-        gzbuffer(fp, 1<<18);
-        if(canonicalize_) for_each_canon<Functor>(func, fp, ks);
-        else              for_each_uncanon<Functor>(func, fp, ks);
-        gzclose(fp);
-        if(pfp) ::pclose(pfp);
+        if(!with_gzfile(path, [&](gzFile fp) {for_each<Functor>(func, fp, ks);}))
+            UNRECOVERABLE_ERROR(ks::sprintf("Could not open file at %s. Abort!\n", path).data());
     }
     template<typename Functor, typename ContainerType,
              typename=typename std::enable_if<std::is_same<typename ContainerType::value_type::value_type, char>::value ||
@@ -538,10 +1090,230 @@ public:
             for_each<Functor>(func, get_cstr(el), ks);
         }
     }
+    /*
+     * Super-k-mers: for windowed Spacers, calls func(minimizer, start, end) once per maximal run of
+     * consecutive windows selecting the same minimizer, where the run's windows together cover s[start, end).
+     * for_each would have emitted that minimizer superkmer_windows(start, end) times in a row.
+     */
+    template<typename Functor>
+    void for_each_superkmer(const Functor &func, const char *str, u64 l) {
+        if(sp_.unwindowed()) UNRECOVERABLE_ERROR("for_each_superkmer requires a windowed Spacer");
+        // During for_each's callback, pos() is start + k for unspaced seeds and start + 1 for spaced seeds.
+        const u64 off = sp_.unspaced() ? sp_.k_: 1;
+        KmerT cur = ENCODE_OVERFLOW;
+        u64 cstart = 0, cend = 0;
+        for_each([&](KmerT km) {
+            const u64 wend = std::min(l, pos_ - off + sp_.c_), wstart = wend > sp_.w_ ? wend - sp_.w_: 0;
+            if(km == cur && wend == cend + 1) {
+                cend = wend;
+                return;
+            }
+            if(cur != ENCODE_OVERFLOW) func(cur, cstart, cend);
+            cur = km; cstart = wstart; cend = wend;
+        }, str, l);
+        if(cur != ENCODE_OVERFLOW) func(cur, cstart, cend);
+    }
+    template<typename Functor>
+    void for_each_superkmer(const Functor &func, kseq_t *ks) {
+        while(kseq_read(ks) >= 0) for_each_superkmer<Functor>(func, record_seq(ks), ks->seq.l);
+    }
+    u64 superkmer_windows(u64 start, u64 end) const {
+        return end - start >= sp_.w_ ? end - start - sp_.w_ + 1: 1;
+    }
+    /*
+     * Push API: feed a record in buffers of any size, then call end_record.
+     * Each feed emits the k-mers (or window minimizers) which end within its buffer, so the concatenated output
+     * matches for_each over the whole record. Only the last c - 1 characters are kept between calls, and the
+     * window queue carries over; the partial window a short record emits is emitted by end_record.
+     * Six-frame translation, mod-minimizers, DUST masking and homopolymer compression need more context than that,
+     * so they hold the record until end_record.
+     * pos() is relative to the buffer being encoded during feed callbacks.
+     */
+    bool streamable() const {
+        return rht != PROTEIN_6_FRAME && sampling_ != Sampling::ModMinimizer && !dust_ && !hpc_;
+    }
+    template<typename Functor>
+    void feed(const Functor &func, const char *s, u64 n) {
+        if(!streamable()) {
+            stream_buf_.append(s, n);
+            return;
+        }
+        if(!streaming_) {
+            if(!sp_.unwindowed()) qmap_.reset();
+            streaming_ = true;
+        }
+        const u64 h = sp_.c_ - 1;
+        if(!stream_buf_.empty()) {
+            // k-mers starting in the carried characters and ending in the first h of s
+            stream_buf_.append(s, std::min(n, h));
+            for_each(func, stream_buf_.data(), stream_buf_.size());
+        }
+        for_each(func, s, n);
+        if(n >= h) stream_buf_.assign(s + n - h, h);
+        else {
+            if(stream_buf_.empty()) stream_buf_.assign(s, n);
+            if(stream_buf_.size() > h) stream_buf_.erase(0, stream_buf_.size() - h);
+        }
+    }
+    template<typename Functor>
+    void end_record(const Functor &func) {
+        if(!streamable()) {
+            if(!stream_buf_.empty()) for_each(func, stream_buf_.data(), stream_buf_.size());
+        } else if(streaming_ && sp_.unspaced() && !sp_.unwindowed() && sampling_ == Sampling::Minimizer
+                  && (is_entropy || !(canonicalize_ && rht == DNA)) && qmap_.partially_full()) {
+            // As for_each_uncanon_unspaced_windowed(_entropy_) do at the end of a record
+            KmerT km = qmap_.max_in_queue().el_;
+            if(is_entropy && canonicalize_ && rht == DNA) km = canonical_representation(km, sp_.k_);
+            if(fmh_thresh_ == u64(-1) || fmh_hash(km) <= fmh_thresh_) func(km);
+        }
+        reset();
+    }
+    // Discards the current record without emitting anything further.
+    void reset() {
+        stream_buf_.clear();
+        streaming_ = false;
+        if(!sp_.unwindowed()) qmap_.reset();
+    }
+    // Batched variants of for_each and for_each_hash (see batch.h).
+    // func receives a KmerSpan of up to DEFAULT_BATCH_SIZE k-mers, or buf.size() when a buffer is provided;
+    // the remaining arguments are forwarded unchanged.
+    // Batches may span records when reading from files, and pos() is not meaningful inside func.
+    template<typename Functor, typename...Args>
+    void for_each_batch(const Functor &func, std::vector<KmerT> &buf, Args &&...args) {
+        if(buf.empty()) buf.resize(DEFAULT_BATCH_SIZE);
+        BatchEmitter<KmerT, Functor> emitter(buf.data(), buf.size(), func);
+        for_each([&emitter](KmerT x) {emitter(x);}, std::forward<Args>(args)...);
+        emitter.flush();
+    }
+    template<typename Functor, typename...Args>
+    void for_each_batch(const Functor &func, Args &&...args) {
+        KmerT buf[DEFAULT_BATCH_SIZE];
+        BatchEmitter<KmerT, Functor> emitter(buf, DEFAULT_BATCH_SIZE, func);
+        for_each([&emitter](KmerT x) {emitter(x);}, std::forward<Args>(args)...);
+        emitter.flush();
+    }
+    template<typename Functor, typename...Args>
+    void for_each_hash_batch(const Functor &func, Args &&...args) {
+        u64 buf[DEFAULT_BATCH_SIZE];
+        BatchEmitter<u64, Functor> emitter(buf, DEFAULT_BATCH_SIZE, func);
+        for_each_hash([&emitter](u64 x) {emitter(x);}, std::forward<Args>(args)...);
+        emitter.flush();
+    }
+
+    // Intra-sequence parallel encoding.
+    // The k-mer start positions of s are split into chunks of chunksize. Each chunk is encoded
+    // by a copy of this Encoder over a substring which begins w - c bases early, so that its window
+    // is full on reaching the chunk, and which ends c - 1 bases late; warm-up emissions are discarded using pos().
+    // This reproduces the serial stream exactly for unwindowed seeds, spaced seeds and canonical DNA minimizers,
+    // where every k-mer start occupies a window slot. Other configurations, like short sequences
+    // or homopolymer compression (where k-mers don't span a fixed number of bases), are encoded serially.
+    static constexpr u64 PARALLEL_CHUNK_SIZE = 1ull << 20;
+    bool parallelizable() const {
+        if(rht == PROTEIN_6_FRAME || sampling_ == Sampling::ModMinimizer || hpc_) return false;
+        return sp_.unwindowed() || !sp_.unspaced() || (canonicalize_ && rht == DNA && !is_entropy);
+    }
+    // Emits the serial stream, in order, on the calling thread.
+    // Chunks are encoded nthreads at a time, buffering at most nthreads * chunksize k-mers.
+    template<typename Functor>
+    void for_each_parallel(const Functor &func, const char *s, u64 l, unsigned nthreads, u64 chunksize=PARALLEL_CHUNK_SIZE) {
+        if(nthreads <= 1 || !parallelizable() || l < sp_.c_ + 2 * chunksize) {
+            for_each(func, s, l);
+            return;
+        }
+        const u64 nstarts = l - sp_.c_ + 1, nchunks = (nstarts + chunksize - 1) / chunksize;
+        std::vector<std::vector<KmerT>> bufs(nthreads);
+        std::vector<std::thread> threads;
+        for(u64 round = 0; round < nchunks; round += nthreads) {
+            const unsigned nr = std::min<u64>(nthreads, nchunks - round);
+            threads.clear();
+            for(unsigned t = 0; t < nr; ++t) {
+                threads.emplace_back([&,t]() {
+                    auto &buf = bufs[t];
+                    buf.clear();
+                    const u64 a = (round + t) * chunksize;
+                    encode_chunk_([&buf](KmerT km) {buf.push_back(km);}, s, l, a, std::min(a + chunksize, nstarts));
+                });
+            }
+            for(auto &t: threads) t.join();
+            for(unsigned t = 0; t < nr; ++t)
+                for(const KmerT km: bufs[t]) func(km);
+        }
+    }
+    // Emits the serial stream's k-mers from nthreads worker threads as func(kmer, thread_index), in no particular order.
+    // func must be safe to call concurrently with distinct thread indices (e.g., per-thread sets).
+    template<typename Functor>
+    void for_each_parallel_unordered(const Functor &func, const char *s, u64 l, unsigned nthreads, u64 chunksize=PARALLEL_CHUNK_SIZE) {
+        if(nthreads <= 1 || !parallelizable() || l < sp_.c_ + 2 * chunksize) {
+            for_each([&func](KmerT km) {func(km, 0u);}, s, l);
+            return;
+        }
+        const u64 nstarts = l - sp_.c_ + 1, nchunks = (nstarts + chunksize - 1) / chunksize;
+        std::atomic<u64> next(0);
+        std::vector<std::thread> threads;
+        for(unsigned t = 0; t < std::min<u64>(nthreads, nchunks); ++t) {
+            threads.emplace_back([&,t]() {
+                for(u64 ci; (ci = next++) < nchunks;) {
+                    const u64 a = ci * chunksize;
+                    encode_chunk_([&func,t](KmerT km) {func(km, t);}, s, l, a, std::min(a + chunksize, nstarts));
+                }
+            });
+        }
+        for(auto &t: threads) t.join();
+    }
+    template<typename Functor>
+    void for_each_parallel(const Functor &func, kseq_t *ks, unsigned nthreads) {
+        while(kseq_read(ks) >= 0) for_each_parallel<Functor>(func, record_seq(ks), ks->seq.l, nthreads);
+    }
+    template<typename Functor>
+    void for_each_parallel_unordered(const Functor &func, kseq_t *ks, unsigned nthreads) {
+        while(kseq_read(ks) >= 0) for_each_parallel_unordered<Functor>(func, record_seq(ks), ks->seq.l, nthreads);
+    }
+    template<typename Functor>
+    void for_each_parallel(const Functor &func, gzFile fp, unsigned nthreads, kseq_t *ks=nullptr) {
+        bool destroy;
+        if(ks == nullptr) ks = kseq_init(fp), destroy = true;
+        else            kseq_assign(ks, fp), destroy = false;
+        for_each_parallel<Functor>(func, ks, nthreads);
+        if(destroy) kseq_destroy(ks);
+    }
+    template<typename Functor>
+    void for_each_parallel(const Functor &func, const char *path, unsigned nthreads, kseq_t *ks=nullptr) {
+        if(!with_gzfile(path, [&](gzFile fp) {for_each_parallel<Functor>(func, fp, nthreads, ks);}))
+            UNRECOVERABLE_ERROR(ks::sprintf("Could not open file at %s. Abort!\n", path).data());
+    }
+    template<typename Functor>
+    void encode_chunk_(const Functor &func, const char *s, u64 l, u64 a, u64 b) {
+        // Encodes the k-mers starting in [a, b) with a private copy of this Encoder.
+        const u64 wsz = sp_.unwindowed() ? 1: sp_.w_ - sp_.c_ + 1;
+        // A DUST window reaches back w - k bases before the k-mer it is checked for, including those in the first window.
+        const u64 dback = dust_ && dust_->window() > sp_.k_ ? dust_->window() - sp_.k_: 0;
+        const u64 back = wsz - 1 + dback;
+        const u64 a0 = a >= back ? a - back: 0;
+        const u64 end = std::min(l, b + sp_.c_ - 1);
+        // During the callback, pos() is start + k for unspaced seeds and start + 1 for spaced seeds.
+        const u64 off = sp_.unspaced() ? sp_.k_: 1;
+        Encoder enc(*this);
+        enc.for_each([&](KmerT km) {if(enc.pos() - off + a0 >= a) func(km);}, s + a0, end - a0);
+    }
 
     size_t rhmul() const {
         return mul(rht);
     }
+    // PROTEIN20, PROTEIN_14 and PROTEIN_6 k-mers are base-mul numbers below mul^k.
+    // Rolling loops remove the oldest symbol c by subtracting drop[c] = c * mul^(k - 1)
+    // instead of reducing modulo mul^k on every character.
+    // Earlier versions combined symbols as (min * mul) | c, so these values changed with database format version 2 (see database.h).
+    bool mixed_radix() const {
+        return rht == PROTEIN20 || rht == PROTEIN_14 || rht == PROTEIN_6;
+    }
+    std::array<KmerT, 20> radix_drop_table() const {
+        std::array<KmerT, 20> ret{};
+        const size_t mul = rhmul();
+        KmerT top = 1;
+        for(unsigned i = 1; i < sp_.k_; ++i) top *= mul;
+        for(size_t c = 0; c < std::min(mul, ret.size()); ++c) ret[c] = top * c;
+        return ret;
+    }
 
     // Encodes a kmer starting at `start` within string `s_`.
     INLINE KmerT kmer(unsigned start) {
@@ -576,12 +1348,12 @@ public:
 #undef ITER
         } else if(rht == PROTEIN20 || rht == PROTEIN_14 || rht == PROTEIN_6) {
             const size_t mul = rht == PROTEIN20 ? 20: rht == PROTEIN_14 ? 14: 6;
-#define ITER do {new_kmer *= mul, start += *spaces++;\
+#define ITER do {start += *spaces++;\
             if((nextc = lutptr[s_[start]]) == int8_t(-1)) {\
                 new_kmer = ENCODE_OVERFLOW;\
                 goto rnk;\
             }\
-            new_kmer = (new_kmer * mul) | nextc;\
+            new_kmer = new_kmer * mul + nextc;\
             CONST_IF(isent) ent_tracker->push(nextc);\
         } while(0);
             DO_DUFF(len, ITER);
@@ -622,11 +1394,11 @@ public:
     INLINE KmerT next_canonicalized_minimizer() {
         assert(has_next_kmer());
         KmerT nk = kmer(pos_++);
-        if(rht == DNA) nk = canonical_representation(nk, sp_.k_);
+        if(rht == DNA && nk != ENCODE_OVERFLOW) nk = canonical_representation(nk, sp_.k_);
         const KmerT kscore(scorer_(nk, getdata()));
         return qmap_.next_value(nk, kscore);
     }
-    auto max_in_queue() const {return qmap_.begin()->first;}
+    const auto &max_in_queue() const {return qmap_.max_in_queue();}
 
     bool canonicalize() const {return canonicalize_;}
     void canonicalize(bool value) {canonicalize_ = value;}
@@ -655,6 +1427,11 @@ public:
     uint64_t seed1_, seed2_;
     QueueMap<IntType, uint64_t> qmap_;
     const int8_t *lutptr = (const int8_t *)cstr_lut;
+    u64 fmh_thresh_ = u64(-1); // FracMinHash threshold; -1 keeps everything
+    QualityMask qmask_;
+    bool hpc_ = false; // Homopolymer compression
+    std::vector<int8_t> hpc_ring_; // Codes of the last k (compressed) symbols, for for_each_scalar_
+    std::vector<u64> pos_ring_; // for_each_with_pos: starts and strands of queued hashes (see for_each_scalar_)
     long long int window() const {return w_;}
     InputType hashtype() const {return enctype_;}
     RollingHasher &hashtype(InputType rht) {
@@ -678,6 +1455,7 @@ public:
             std::fprintf(stderr, "Note: RollingHasher with Protein alphabet does not support reverse-complementing.\n");
             canon_ = false;
         }
+        if(enc != InputType::DNA) lutptr = rh2lp(enc);
         window(wsz);
         hasher_.seed(seed1, seed2);
         rchasher_.seed(seed2 * seed1, seed2 ^ seed1);
@@ -685,13 +1463,39 @@ public:
     }
     RollingHasher& operator=(const RollingHasher &o) {
         k_ = o.k_; canon_ = o.canon_; enctype_ = o.enctype_; w_ = o.w_; seed1_ = o.seed1_; seed2_ = o.seed2_;
+        fmh_thresh_ = o.fmh_thresh_; qmask_ = o.qmask_; lutptr = o.lutptr; hpc_ = o.hpc_;
         window(o.w_);
         return *this;
     }
-    RollingHasher(const RollingHasher &o): RollingHasher(o.k_, o.canon_, o.enctype_, o.w_, o.seed1_, o.seed2_) {}
+    RollingHasher(const RollingHasher &o): RollingHasher(o.k_, o.canon_, o.enctype_, o.w_, o.seed1_, o.seed2_) {fmh_thresh_ = o.fmh_thresh_; qmask_ = o.qmask_; hpc_ = o.hpc_;}
+    // Keeps only hashes passing a FracMinHash filter with this scale; 1 disables it.
+    void scaled(double scale) {fmh_thresh_ = fmh_threshold(scale);}
+    u64 scaled_threshold() const {return fmh_thresh_;}
+    // Skips k-mers containing bases with Phred quality below phred in FASTQ records; 0 disables it.
+    void min_quality(unsigned phred) {
+        if(phred > QualityMask::MAX_PHRED) UNRECOVERABLE_ERROR(std::string("Phred threshold out of range: ") + std::to_string(phred));
+        qmask_.threshold(phred);
+    }
+    unsigned min_quality() const {return qmask_.threshold();}
+    // Collapses runs of the same symbol (and of ambiguous characters) before hashing; see Encoder::homopolymer_compress.
+    void homopolymer_compress(bool value) {hpc_ = value;}
+    bool homopolymer_compress() const {return hpc_;}
+    // Calls body with func, or with func behind the FracMinHash filter if scaled.
+    template<typename Functor, typename Body>
+    void with_scaled_(const Functor &func, const Body &body) {
+        if(fmh_thresh_ == u64(-1)) body(func);
+        else {
+            const u64 thresh = fmh_thresh_;
+            body([&func,thresh](IntType x) {if(fmh_value(x) <= thresh) func(x);});
+        }
+    }
     template<typename Functor>
     void for_each_canon(const Functor &func, const char *s, size_t l) {
         qmap_.reset();
+        if(unlikely(hpc_)) {
+            for_each_scalar_<false>(func, s, l, enctype_ == DNA);
+            return;
+        }
         if(enctype_ != DNA) {
             for_each_uncanon<Functor>(func, s, l);
             return;
@@ -711,14 +1515,15 @@ public:
             for(i = nf = 0; nf < k_ && i < l; ++i) {
                 if((v1 = cstr_lut[s[i]]) == uint8_t(-1)) {
                     fixup_minimizer:
-                    if(i + 2 * k_ >= l) goto end;
-                    i += k_;
+                    // Resume at the first base after the run of N (the loop increment lands on it).
+                    if((i = skip_ambiguous_run(s, i + 1, l, cstr_lut)) + k_ > l) goto end;
+                    --i;
                     nf = 0;
                     hasher_.reset();
                     rchasher_.reset();
                 } // Fixme: this ignores both strands when one becomes 'N'-contaminated.
                   // In the future, encode the side that is still valid
-                else hasher_.eat(v1), rchasher_.eat(cstr_rc_lut[s[i - nf + k_ - 1]]), ++nf;
+                else hasher_.eat(v1), rchasher_.eat(cstr_rc_lut[s[i - 2 * nf + k_ - 1]]), ++nf;
             }
             if(nf < k_) goto end; // All failed
             add_hashes(hasher_);
@@ -738,14 +1543,14 @@ public:
             for(i = nf = 0; nf < k_ && i < l; ++i) {
                 if((v1 = cstr_lut[s[i]]) == uint8_t(-1)) {
                     fixup:
-                    if(i + 2 * k_ >= l) return;
-                    i += k_;
+                    if((i = skip_ambiguous_run(s, i + 1, l, cstr_lut)) + k_ > l) return;
+                    --i;
                     nf = 0;
                     hasher_.reset();
                     rchasher_.reset();
                 } // Fixme: this ignores both strands when one becomes 'N'-contaminated.
                   // In the future, encode the side that is still valid
-                else hasher_.eat(v1), rchasher_.eat(cstr_rc_lut[s[i - nf + k_ - 1]]), ++nf;
+                else hasher_.eat(v1), rchasher_.eat(cstr_rc_lut[s[i - 2 * nf + k_ - 1]]), ++nf;
             }
             if(nf < k_) return; // All failed
             func(std::min(hasher_.hashvalue, rchasher_.hashvalue));
@@ -761,6 +1566,11 @@ public:
 
     template<typename Functor>
     void for_each_uncanon(const Functor &func, const char *s, size_t l) {
+        if(unlikely(hpc_)) {
+            qmap_.reset();
+            for_each_scalar_<false>(func, s, l, false);
+            return;
+        }
         if(l < size_t(k_)) return;
         hasher_.reset();
         qmap_.reset();
@@ -779,10 +1589,13 @@ public:
             if(unlikely((v1 = lutptr[s[i]]) == int8_t(-1))) {
                 //std::fprintf(stderr, "Char %c/%d was missing... %d\n", s[i], s[i], lutptr[s[i]]);
                 fixup:
-                i += k_; nf = 0; hasher_.reset();
+                i = skip_ambiguous_run(s, i + 1, l, lutptr) - 1; nf = 0; hasher_.reset();
             } else hasher_.eat(v1), ++nf;
         }
-        if(nf < k_) return; // All failed
+        if(nf < k_) { // All failed, or the record ended while refilling after an ambiguous base
+            if(qmap_.partially_full()) func(max_in_queue().el_);
+            return;
+        }
         use_val(hasher_.hashvalue);
         for(;i < l; ++i) {
             if(lutptr[s[i]] == int8_t(-1)) goto fixup;
@@ -794,48 +1607,127 @@ public:
         if(qmap_.partially_full())
             func(max_in_queue().el_);
     }
+    /*
+     * for_each_canon/for_each_uncanon as a scalar loop, used under homopolymer compression and by for_each_with_pos,
+     * and kept out of line so their loops are unaffected.
+     * The symbols leaving the window are read from hpc_ring_ instead of s, and under compression the output matches
+     * hashing the compressed sequence. With with_pos, func is called as func(hash, start, rc);
+     * starts and strands of queued hashes are kept in pos_ring_ by their index in qmap_, as in Encoder::for_each_filtered_.
+     */
+    template<bool with_pos, typename Functor>
+    __attribute__((noinline)) void for_each_scalar_(const Functor &func, const char *s, size_t l, bool canon) {
+        const size_t k = k_;
+        const bool hpc = hpc_, windowed = qmap_.size() > 1;
+        size_t ringsz = 1;
+        while(ringsz < k) ringsz <<= 1;
+        if(hpc_ring_.size() < ringsz) hpc_ring_.resize(ringsz);
+        int8_t *const ring = hpc_ring_.data();
+        const size_t mask = ringsz - 1;
+        // with_pos: pos_ring_ holds queued hashes' (start << 1) | rc in [0, smask],
+        // then the index in s of each of the last k (compressed) symbols in [smask + 1, smask + ringsz].
+        u64 smask = 0, *slotpos = nullptr, *basepos = nullptr;
+        CONST_IF(with_pos) {
+            smask = windowed ? roundup64(qmap_.size() + 1) - 1: 0;
+            if(pos_ring_.size() < smask + 1 + ringsz) pos_ring_.resize(smask + 1 + ringsz);
+            slotpos = pos_ring_.data();
+            basepos = slotpos + smask + 1;
+        }
+        IntType nextv;
+        auto call = [&](IntType v, u64 info) {
+            CONST_IF(with_pos) func(v, info >> 1, bool(info & 1));
+            else               func(v);
+        };
+        auto add = [&](IntType v, u64 info) {
+            CONST_IF(with_pos) slotpos[qmap_.n_added() & smask] = info;
+            if((nextv = qmap_.next_value(v, lex_score(v))) != ENCODE_OVERFLOW)
+                call(nextv, with_pos ? slotpos[qmap_.max_index() & smask]: u64(0));
+        };
+        size_t n = 0; // (Compressed) symbols since the last ambiguous run
+        int8_t last = -1;
+        hasher_.reset();
+        rchasher_.reset();
+        for(size_t i = 0; i < l; ++i) {
+            const int8_t c = lutptr[static_cast<uint8_t>(s[i])];
+            if(c == int8_t(-1)) {
+                i = skip_ambiguous_run(s, i + 1, l, lutptr) - 1;
+                n = 0; last = -1;
+                hasher_.reset();
+                rchasher_.reset();
+                continue;
+            }
+            if(hpc) {
+                if(c == last) continue;
+                last = c;
+            }
+            CONST_IF(with_pos) basepos[n & mask] = i;
+            if(n < k) {
+                hasher_.eat(c);
+                ring[n++ & mask] = c;
+                if(n < k) continue;
+                if(canon) for(size_t j = k; j--;) rchasher_.eat(3 - ring[j & mask]);
+            } else {
+                const int8_t out = ring[(n - k) & mask];
+                hasher_.update(out, c);
+                if(canon) rchasher_.reverse_update(3 - c, 3 - out);
+                ring[n++ & mask] = c;
+            }
+            const u64 start = with_pos ? u64(basepos[(n - k) & mask]) << 1: u64(0);
+            if(windowed) {
+                add(hasher_.hashvalue, start);
+                if(canon) add(rchasher_.hashvalue, start | 1);
+            } else if(canon) {
+                const bool rc = rchasher_.hashvalue < hasher_.hashvalue;
+                call(rc ? rchasher_.hashvalue: hasher_.hashvalue, start | rc);
+            } else if(hasher_.hashvalue != ENCODE_OVERFLOW) call(hasher_.hashvalue, start);
+        }
+        if(qmap_.partially_full())
+            call(max_in_queue().el_, with_pos ? slotpos[qmap_.max_index() & smask]: u64(0));
+    }
+    /*
+     * As for_each_hash, calling func(hash, start, rc) with the offset in s of the k-mer's first base
+     * and whether hash is that of its reverse complement (only when canonicalizing).
+     * For windowed hashers, these locate the selected minimizer.
+     */
+    template<typename Functor>
+    void for_each_with_pos(const Functor &func, const char *s, size_t l) {
+        qmap_.reset();
+        const bool canon = canon_ && enctype_ == DNA;
+        if(fmh_thresh_ == u64(-1)) for_each_scalar_<true>(func, s, l, canon);
+        else {
+            const u64 thresh = fmh_thresh_;
+            for_each_scalar_<true>([&func,thresh](IntType x, u64 start, bool rc) {if(fmh_value(x) <= thresh) func(x, start, rc);}, s, l, canon);
+        }
+    }
     template<typename Functor>
     void for_each_canon(const Functor &func, kseq_t *ks) {
         while(kseq_read(ks) >= 0) {
-            for_each_canon<Functor>(func, ks->seq.s, ks->seq.l);
+            for_each_canon<Functor>(func, qmask_.apply(ks->seq.s, ks->qual.s, ks->seq.l, ks->qual.l, lutptr), ks->seq.l);
         }
     }
     template<typename Functor>
     void for_each_uncanon(const Functor &func, kseq_t *ks) {
         while(kseq_read(ks) >= 0) {
-            for_each_uncanon<Functor>(func, ks->seq.s, ks->seq.l);
+            for_each_uncanon<Functor>(func, qmask_.apply(ks->seq.s, ks->qual.s, ks->seq.l, ks->qual.l, lutptr), ks->seq.l);
         }
     }
     template<typename Functor>
     void for_each_hash(const Functor &func, const char *s, size_t l) {
-        if(canon_) {
-            for_each_canon<Functor>(func, s, l);
-        } else       for_each_uncanon<Functor>(func, s, l);
+        with_scaled_(func, [&](const auto &f) {
+            if(canon_) for_each_canon(f, s, l);
+            else       for_each_uncanon(f, s, l);
+        });
     }
     template<typename Functor>
     void for_each_hash(const Functor &func, gzFile fp, kseq_t *ks=nullptr) {
-        if(canon_) for_each_canon<Functor>(func, fp, ks);
-        else       for_each_uncanon<Functor>(func, fp, ks);
+        with_scaled_(func, [&](const auto &f) {
+            if(canon_) for_each_canon(f, fp, ks);
+            else       for_each_uncanon(f, fp, ks);
+        });
     }
     template<typename Functor>
     void for_each_hash(const Functor &func, const char *inpath, kseq_t *ks=nullptr) {
-        const size_t pl = std::strlen(inpath);
-        std::FILE *pfp = 0;
-        gzFile fp = 0;
-        bool matchxz = pl >= 3 && std::equal(&inpath[pl - 3], &inpath[pl], ".xz");
-        bool matchbz = pl >= 4 && std::equal(&inpath[pl - 4], &inpath[pl], ".bz2");
-        bool matchzst = pl >= 4 && std::equal(&inpath[pl - 4], &inpath[pl], ".zst");
-        if(matchxz || matchbz || matchzst) {
-            std::string cmd = std::string(matchxz ? "xz": (matchbz ? "bzip2": "zstd")) + " -dc " + inpath;
-            pfp = ::popen(cmd.data(), "r");
-            if(!pfp) UNRECOVERABLE_ERROR(std::string("Failed to open popen call: ") + cmd);
-            fp = gzdopen(::fileno(pfp), "rb");
-        } else fp = gzopen(inpath, "rb");
-        if(!fp) UNRECOVERABLE_ERROR(std::string("Could not open file at ") + inpath);
-        gzbuffer(fp, 1<<18);
-        for_each_hash<Functor>(func, fp, ks);
-        gzclose(fp);
-        if(pfp) ::pclose(pfp);
+        if(!with_gzfile(inpath, [&](gzFile fp) {for_each_hash<Functor>(func, fp, ks);}))
+            UNRECOVERABLE_ERROR(std::string("Could not open file at ") + inpath);
     }
     template<typename Functor>
     INLINE void for_each_uncanon(const Functor &func, gzFile fp, kseq_t *ks=nullptr) {
@@ -857,9 +1749,167 @@ public:
     void for_each(Args &&...args) {
         for_each_hash(std::forward<Args>(args)...);
     }
+    // Batched for_each_hash: func receives a KmerSpan<IntType> of up to DEFAULT_BATCH_SIZE hashes (see batch.h).
+    template<typename Functor, typename...Args>
+    void for_each_batch(const Functor &func, Args &&...args) {
+        IntType buf[DEFAULT_BATCH_SIZE];
+        BatchEmitter<IntType, Functor> emitter(buf, DEFAULT_BATCH_SIZE, func);
+        for_each_hash([&emitter](IntType x) {emitter(x);}, std::forward<Args>(args)...);
+        emitter.flush();
+    }
+    /*
+     * Multi-read hashing: calls func(i, hash) for the hashes of reads seqs[0, n), given their lengths and,
+     * optionally, qualities (either array of quals may be null).
+     * Each read yields what for_each_hash would, in order, but hashes of different reads are interleaved.
+     * With AVX2, 64-bit cyclic hashes are computed LaneCyclicHash::LANES reads at a time (see lanehash.h);
+     * otherwise (or under homopolymer compression), reads are hashed one at a time.
+     */
+    template<typename Functor>
+    void for_each_hash_lanes(const Functor &func, size_t n, const char *const *seqs, const size_t *lens, const char *const *quals=nullptr) {
+#if __AVX2__
+        CONST_IF(sizeof(IntType) == sizeof(uint64_t) && std::is_same<HashClass, CyclicHash<IntType>>::value) {
+            if(!hpc_) {
+                for_each_hash_lanes_(func, n, seqs, lens, quals);
+                return;
+            }
+        }
+#endif
+        for(size_t i = 0; i < n; ++i) {
+            const char *q = quals ? quals[i]: nullptr;
+            for_each_hash([&func,i](IntType x) {func(i, x);}, qmask_.apply(seqs[i], q, lens[i], q ? lens[i]: 0, lutptr), lens[i]);
+        }
+    }
+    template<typename Functor>
+    void for_each_hash_lanes(const Functor &func, const bseq1_t *recs, size_t n) {
+        std::vector<const char *> seqs(n), quals(n);
+        std::vector<size_t> lens(n);
+        for(size_t i = 0; i < n; ++i) seqs[i] = recs[i].seq, quals[i] = recs[i].qual, lens[i] = recs[i].l_seq;
+        for_each_hash_lanes(func, n, seqs.data(), lens.data(), quals.data());
+    }
+    // File-level multi-read hashing: func(i, hash) receives the hashes of the i-th record.
+    // Records are gathered into batches of LANE_BATCH_BASES bases; those of at least LANE_MAX_READ bases
+    // are hashed on their own, as they would leave the other lanes idle.
+    static constexpr size_t LANE_BATCH_BASES = 1ull << 20, LANE_MAX_READ = 1ull << 14;
+    template<typename Functor>
+    void for_each_hash_lanes(const Functor &func, kseq_t *ks) {
+        std::vector<std::string> seqs, quals;
+        std::vector<const char *> sptrs, qptrs;
+        std::vector<size_t> lens;
+        size_t n = 0, nbases = 0, first = 0;
+        auto flush = [&]() {
+            if(!n) return;
+            for(size_t i = 0; i < n; ++i)
+                sptrs[i] = seqs[i].data(), qptrs[i] = quals[i].empty() ? nullptr: quals[i].data();
+            for_each_hash_lanes([&func,first](size_t i, IntType x) {func(first + i, x);}, n, sptrs.data(), lens.data(), qptrs.data());
+            first += n;
+            n = nbases = 0;
+        };
+        while(kseq_read(ks) >= 0) {
+            if(ks->seq.l >= LANE_MAX_READ) {
+                flush();
+                const size_t i = first++;
+                for_each_hash([&func,i](IntType x) {func(i, x);}, qmask_.apply(ks->seq.s, ks->qual.s, ks->seq.l, ks->qual.l, lutptr), ks->seq.l);
+                continue;
+            }
+            if(n == seqs.size()) seqs.emplace_back(), quals.emplace_back(), sptrs.emplace_back(), qptrs.emplace_back(), lens.emplace_back();
+            seqs[n].assign(ks->seq.s, ks->seq.l);
+            if(ks->qual.l) quals[n].assign(ks->qual.s, ks->qual.l);
+            else           quals[n].clear();
+            lens[n++] = ks->seq.l;
+            if((nbases += ks->seq.l) >= LANE_BATCH_BASES) flush();
+        }
+        flush();
+    }
+    template<typename Functor>
+    void for_each_hash_lanes(const Functor &func, gzFile fp, kseq_t *ks=nullptr) {
+        bool destroy;
+        if(ks == nullptr) ks = kseq_init(fp), destroy = true;
+        else            kseq_assign(ks, fp), destroy = false;
+        for_each_hash_lanes<Functor>(func, ks);
+        if(destroy) kseq_destroy(ks);
+    }
+    template<typename Functor>
+    void for_each_hash_lanes(const Functor &func, const char *inpath, kseq_t *ks=nullptr) {
+        if(!with_gzfile(inpath, [&](gzFile fp) {for_each_hash_lanes<Functor>(func, fp, ks);}))
+            UNRECOVERABLE_ERROR(std::string("Could not open file at ") + inpath);
+    }
+private:
+#if __AVX2__
+    template<typename Functor>
+    void for_each_hash_lanes_(const Functor &func, size_t n, const char *const *seqs, const size_t *lens, const char *const *quals) {
+        using LH = LaneCyclicHash;
+        static constexpr unsigned L = LH::LANES;
+        const bool canon = canon_ && enctype_ == DNA, windowed = qmap_.size() > 1;
+        const size_t k = k_;
+        int64_t codes[256];
+        unsigned nsym = 0;
+        for(unsigned c = 0; c < 256; ++c) {
+            const int v = c < 128 ? lutptr[c]: -1; // cstr_lut only covers ASCII
+            codes[c] = LH::lane_code(v);
+            nsym = std::max(nsym, unsigned(v + 1));
+        }
+        const int minq = qmask_.threshold() ? int(qmask_.threshold() + QualityMask::PHRED_OFFSET): 0;
+        LH lh(hasher_.hasher.hashvalues.data(), rchasher_.hasher.hashvalues.data(), k, nsym, canon);
+        std::vector<QueueMap<IntType, uint64_t>> qms(windowed ? L: 0, qmap_);
+        const u64 thresh = fmh_thresh_;
+        auto emit = [&](size_t r, IntType x) {if(thresh == u64(-1) || fmh_value(x) <= thresh) func(r, x);};
+        size_t rid[L], pos[L], next = 0;
+        bool active[L];
+        // Reads shorter than k yield nothing, so lanes skip them.
+        auto load = [&](unsigned j) {
+            while(next < n && lens[next] < k) ++next;
+            if((active[j] = next < n)) {
+                rid[j] = next++; pos[j] = 0;
+                lh.reset_lane(j);
+                if(windowed) qms[j].reset();
+            }
+        };
+        for(unsigned j = 0; j < L; ++j) load(j);
+        for(;;) {
+            size_t nsteps = LH::BLOCK;
+            bool any = false;
+            for(unsigned j = 0; j < L; ++j)
+                if(active[j]) any = true, nsteps = std::min(nsteps, lens[rid[j]] - pos[j]);
+            if(!any) break;
+            const uint64_t t0 = lh.step();
+            for(unsigned j = 0; j < L; ++j) {
+                if(!active[j]) {
+                    for(size_t t = 0; t < nsteps; ++t) lh.codes(t0 + t)[j] = -1;
+                    continue;
+                }
+                const char *s = seqs[rid[j]] + pos[j], *q = quals && quals[rid[j]] && minq ? quals[rid[j]] + pos[j]: nullptr;
+                if(q) for(size_t t = 0; t < nsteps; ++t) lh.codes(t0 + t)[j] = q[t] < minq ? -1: codes[uint8_t(s[t])];
+                else  for(size_t t = 0; t < nsteps; ++t) lh.codes(t0 + t)[j] = codes[uint8_t(s[t])];
+            }
+            lh.step_block(nsteps);
+            // Emit lane by lane, so that each read's values come out in order and each window stays hot.
+            for(unsigned j = 0; j < L; ++j) {
+                if(!active[j]) continue;
+                const size_t r = rid[j];
+                for(size_t t = 0; t < nsteps; ++t) {
+                    if(!(lh.full_[t] >> j & 1)) continue;
+                    const IntType h = lh.hashes_[t * L + j];
+                    if(windowed) {
+                        IntType nextv;
+                        if((nextv = qms[j].next_value(h, lex_score(h))) != ENCODE_OVERFLOW) emit(r, nextv);
+                        if(canon) {
+                            const IntType hr = lh.rchashes_[t * L + j];
+                            if((nextv = qms[j].next_value(hr, lex_score(hr))) != ENCODE_OVERFLOW) emit(r, nextv);
+                        }
+                    } else emit(r, canon ? std::min(h, IntType(lh.rchashes_[t * L + j])): h);
+                }
+                if((pos[j] += nsteps) == lens[r]) {
+                    if(windowed && qms[j].partially_full()) emit(r, qms[j].max_in_queue().el_);
+                    load(j);
+                }
+            }
+        }
+    }
+#endif
+public:
     void reset() {hasher_.reset(); rchasher_.reset();}
     size_t n_in_queue() const {return qmap_.n_in_queue();}
-    auto max_in_queue() const {return qmap_.begin()->first;}
+    const auto &max_in_queue() const {return qmap_.max_in_queue();}
     bool canonicalize() const {return canon_;}
     void canonicalize(bool value) {canon_ = value;}
 };
@@ -868,121 +1918,143 @@ template<typename IType>
 struct RollingHasherSet {
     std::vector<RollingHasher<IType>> hashers_;
     bool canon_;
+    u64 fmh_thresh_ = u64(-1); // FracMinHash threshold, shared by all hashers; -1 keeps everything
+    QualityMask qmask_;
+    void scaled(double scale) {fmh_thresh_ = fmh_threshold(scale);}
+    u64 scaled_threshold() const {return fmh_thresh_;}
+    void min_quality(unsigned phred) {
+        if(phred > QualityMask::MAX_PHRED) UNRECOVERABLE_ERROR(std::string("Phred threshold out of range: ") + std::to_string(phred));
+        qmask_.threshold(phred);
+    }
+    unsigned min_quality() const {return qmask_.threshold();}
+    template<typename Functor, typename Body>
+    void with_scaled_(const Functor &func, const Body &body) {
+        if(fmh_thresh_ == u64(-1)) body(func);
+        else {
+            const u64 thresh = fmh_thresh_;
+            body([&func,thresh](IType x, size_t hi) {if(fmh_value(x) <= thresh) func(x, hi);});
+        }
+    }
     template<typename C>
     RollingHasherSet(const C &c, bool canon=false, InputType enc=DNA, uint64_t seedseed=1337u): canon_(canon) {
         std::mt19937_64 mt(seedseed);
         hashers_.reserve(c.size());
         for(const auto k: c)
-            hashers_.emplace_back(k, canon, enc, mt(), mt());
+            hashers_.emplace_back(k, canon, enc, -1, mt(), mt());
     }
+    /*
+     * As RollingHasher::for_each_canon, for each k: after a run of ambiguous bases, every hasher restarts
+     * at the first base after it, and a hasher's reverse-strand hash is filled from its first k-mer once complete.
+     */
     template<typename Functor>
     void for_each_canon(const Functor &func, const char *s, size_t l) {
-        const auto mink = get_mink();
+        const size_t mink = get_mink();
         if(l < mink) return;
         for(auto &h: hashers_) h.reset();
-        size_t i = 0;
-        long long int nf = 0;
-        uint8_t v1;
-        for(; nf < mink && i < l; ++i) {
-            if((v1 = cstr_lut[s[i]]) == uint8_t(-1)) {
-                fixup:
-                if(i + 2 * mink >= l) return;
-                i += mink;
+        size_t nf = 0; // Bases since the last ambiguous run
+        for(size_t i = 0; i < l; ++i) {
+            const uint8_t v1 = cstr_lut[static_cast<uint8_t>(s[i])];
+            if(v1 == uint8_t(-1)) {
+                // Resume at the first base after the run of N (the loop increment lands on it).
+                if((i = skip_ambiguous_run(s, i + 1, l, cstr_lut)) + mink > l) return;
+                --i;
                 nf = 0;
                 for(auto &h: hashers_) h.reset();
-            } // Fixme: this ignores both strands when one becomes 'N'-contaminated.
-              // In the future, encode the side that is still valid
-            else {
-                for(auto &h: hashers_) h.hasher_.eat(v1), h.rchasher_.eat(cstr_rc_lut[s[h.k_ - i - 1]]);
-                ++nf;
+                continue;
             }
-        }
-        for(size_t hi = 0; hi < hashers_.size(); ++hi) {
-            auto &h(hashers_[hi]);
-            if(nf >= h.k_)
-                func(std::min(h.hasher_.hashvalue, h.rchasher_.hashvalue), hi);
-        }
-        for(;i < l; ++i) {
-            if((v1 = cstr_lut[s[i]]) == uint8_t(-1))
-                goto fixup;
+            ++nf;
             for(size_t hi = 0; hi < hashers_.size(); ++hi) {
                 auto &h(hashers_[hi]);
-                //h.rchasher_.eat(cstr_rc_lut[s[i - nf + h.k_ - 1]]);
-                if(nf >= h.k_) {
-                    h.rchasher_.reverse_update(cstr_rc_lut[s[i]], cstr_rc_lut[s[i - h.k_]]);
-                    h.hasher_.update(cstr_lut[s[i - h.k_]], v1);
-                    func(std::min(h.hasher_.hashvalue, h.rchasher_.hashvalue), hi);
+                const size_t k = h.k_;
+                if(nf > k) {
+                    h.hasher_.update(cstr_lut[static_cast<uint8_t>(s[i - k])], v1);
+                    h.rchasher_.reverse_update(cstr_rc_lut[static_cast<uint8_t>(s[i])], cstr_rc_lut[static_cast<uint8_t>(s[i - k])]);
                 } else {
                     h.hasher_.eat(v1);
-                    h.rchasher_.eat(cstr_rc_lut[s[i + h.k_ - nf - 1]]);
+                    if(nf < k) continue;
+                    for(size_t j = i + 1; j-- > i + 1 - k;) h.rchasher_.eat(cstr_rc_lut[static_cast<uint8_t>(s[j])]);
                 }
+                func(std::min(h.hasher_.hashvalue, h.rchasher_.hashvalue), hi);
             }
-            ++nf;
         }
     }
     uint32_t get_mink() const {return std::accumulate(hashers_.begin(), hashers_.end(), unsigned(-1), [](unsigned x, const auto & y) {return std::min(x, unsigned(y.k_));});}
     template<typename Functor>
     void for_each_uncanon(const Functor &func, const char *s, size_t l) {
-        const auto mink = get_mink();
+        const size_t mink = get_mink();
         if(l < mink) return;
         for(auto &h: hashers_) h.reset();
-        size_t i = 0;
-        long long int nf = 0;
-        uint8_t v1;
-        for(; nf < mink && i < l; ++i) {
-            if((v1 = cstr_lut[static_cast<uint8_t>(s[i])]) == uint8_t(-1)) {
-                fixup:
-                if(i + 2 * mink >= l) return;
-                i += mink;
+        size_t nf = 0; // Bases since the last ambiguous run
+        for(size_t i = 0; i < l; ++i) {
+            const uint8_t v1 = cstr_lut[static_cast<uint8_t>(s[i])];
+            if(v1 == uint8_t(-1)) {
+                if((i = skip_ambiguous_run(s, i + 1, l, cstr_lut)) + mink > l) return;
+                --i;
                 nf = 0;
                 for(auto &h: hashers_) h.hasher_.reset();
-            } // Fixme: this ignores both strands when one becomes 'N'-contaminated.
-              // In the future, encode the side that is still valid
-            else {
-                for(auto &h: hashers_) h.hasher_.eat(v1);
-                ++nf;
+                continue;
             }
-        }
-        for(size_t i = 0; i < hashers_.size(); ++i) {
-            auto &h(hashers_[i]);
-            if(nf >= h.k_)
-                func(h.hasher_.hashvalue, i);
-        }
-        for(;i < l; ++i) {
-            if((v1 = cstr_lut[uint8_t(s[i])]) == uint8_t(-1))
-                goto fixup;
+            ++nf;
             for(size_t hi = 0; hi < hashers_.size(); ++hi) {
                 auto &h(hashers_[hi]);
-                h.hasher_.eat(v1);
-                if(++nf >= h.k_)
-                    func(h.hasher_.hashvalue, hi);
+                const size_t k = h.k_;
+                if(nf > k) h.hasher_.update(cstr_lut[static_cast<uint8_t>(s[i - k])], v1);
+                else {
+                    h.hasher_.eat(v1);
+                    if(nf < k) continue;
+                }
+                func(h.hasher_.hashvalue, hi);
             }
         }
     }
     template<typename Functor>
     void for_each_canon(const Functor &func, kseq_t *ks) {
         while(kseq_read(ks) >= 0) {
-            for_each_canon<Functor>(func, ks->seq.s, ks->seq.l);
+            for_each_canon<Functor>(func, qmask_.apply(ks->seq.s, ks->qual.s, ks->seq.l, ks->qual.l, cstr_lut), ks->seq.l);
         }
     }
     template<typename Functor>
     void for_each_uncanon(const Functor &func, kseq_t *ks) {
         while(kseq_read(ks) >= 0) {
-            for_each_uncanon<Functor>(func, ks->seq.s, ks->seq.l);
+            for_each_uncanon<Functor>(func, qmask_.apply(ks->seq.s, ks->qual.s, ks->seq.l, ks->qual.l, cstr_lut), ks->seq.l);
         }
     }
     template<typename Functor>
+    INLINE void for_each_hash(const Functor &func, const char *s, size_t l) {
+        with_scaled_(func, [&](const auto &f) {
+            if(canon_) for_each_canon(f, s, l);
+            else       for_each_uncanon(f, s, l);
+        });
+    }
+    template<typename Functor>
     INLINE void for_each_hash(const Functor &func, gzFile fp, kseq_t *ks=nullptr) {
-        if(canon_) for_each_canon<Functor>(func, fp, ks);
-        else       for_each_uncanon<Functor>(func, fp, ks);
+        with_scaled_(func, [&](const auto &f) {
+            if(canon_) for_each_canon(f, fp, ks);
+            else       for_each_uncanon(f, fp, ks);
+        });
+    }
+    // Batched for_each_hash: func(KmerSpan<IType>, hasher_index) is called with up to DEFAULT_BATCH_SIZE hashes
+    // from a single hasher at a time, so that per-k consumers can process each span in one go.
+    template<typename Functor, typename...Args>
+    void for_each_batch(const Functor &func, Args &&...args) {
+        const size_t nh = hashers_.size();
+        std::unique_ptr<IType[]> buf(new IType[nh * DEFAULT_BATCH_SIZE]);
+        std::unique_ptr<size_t[]> sizes(new size_t[nh]());
+        for_each_hash([&](IType x, size_t hi) {
+            IType *const hbuf = &buf[hi * DEFAULT_BATCH_SIZE];
+            hbuf[sizes[hi]++] = x;
+            if(sizes[hi] == DEFAULT_BATCH_SIZE) {
+                func(KmerSpan<IType>{hbuf, DEFAULT_BATCH_SIZE}, hi);
+                sizes[hi] = 0;
+            }
+        }, std::forward<Args>(args)...);
+        for(size_t hi = 0; hi < nh; ++hi)
+            if(sizes[hi]) func(KmerSpan<IType>{&buf[hi * DEFAULT_BATCH_SIZE], sizes[hi]}, hi);
     }
     template<typename Functor>
     INLINE void for_each_hash(const Functor &func, const char *inpath, kseq_t *ks=nullptr) {
-        gzFile fp = gzopen(inpath, "rb");
-        if(!fp) throw file_open_error(inpath);
-        gzbuffer(fp, 1<<18);
-        for_each_hash<Functor>(func, fp, ks);
-        gzclose(fp);
+        if(!with_gzfile(inpath, [&](gzFile fp) {for_each_hash<Functor>(func, fp, ks);}))
+            throw file_open_error(inpath);
     }
     template<typename Functor>
     INLINE void for_each_uncanon(const Functor &func, gzFile fp, kseq_t *ks=nullptr) {
@@ -1002,6 +2074,285 @@ struct RollingHasherSet {
     }
 };
 
+/*
+ * NtHashSet: ntHash values of DNA k-mers for several k in one pass.
+ * Each base extends prefix hashes shared by every k, P(i) = rol(P(i - 1), 1) ^ seed(s[i]) and,
+ * for the reverse strand, Q(i) = Q(i - 1) ^ rol(rcseed(s[i]), i), with i counted from the last ambiguous base.
+ * Keeping them in a ring of the last max(k) + 1 positions, the k-mer ending at i hashes to
+ * P(i) ^ rol(P(i - k), k) forward and ror(Q(i) ^ Q(i - k), i - k + 1) reversed:
+ * one rotate and xor per k and strand, where RollingHasherSet rolls a CyclicHash per k.
+ * Values follow ntHash's NTF64/NTR64 recurrences, and the canonical value is their minimum (NTC64).
+ * func is called as func(hash, k_index), as for RollingHasherSet, in increasing order of k at each position.
+ */
+class NtHashSet {
+    std::vector<unsigned> ks_;    // k values, ascending
+    std::vector<uint32_t> order_; // order_[j]: index of ks_[j] in the constructor's argument
+    std::vector<u64> fring_, rring_;
+    u64 mask_;
+    bool canon_;
+    u64 fmh_thresh_ = u64(-1); // FracMinHash threshold, shared by all k; -1 keeps everything
+    QualityMask qmask_;
+    static INLINE u64 rol(u64 x, unsigned r) {return (x << (r & 63)) | (x >> ((64 - r) & 63));}
+    static INLINE u64 ror(u64 x, unsigned r) {return (x >> (r & 63)) | (x << ((64 - r) & 63));}
+    static std::array<u64, 256> make_seed_table(bool rc) {
+        std::array<u64, 256> ret{};
+        const u64 acgt[4] {seedA, seedC, seedG, seedT};
+        for(unsigned c = 0; c < 128; ++c)
+            if(cstr_lut[c] >= 0) ret[c] = acgt[rc ? 3 - cstr_lut[c]: cstr_lut[c]];
+        return ret;
+    }
+public:
+    template<typename C>
+    NtHashSet(const C &c, bool canon=false): canon_(canon) {
+        for(const auto k: c) {
+            if(k <= 0) UNRECOVERABLE_ERROR(std::string("Invalid k: ") + std::to_string(k));
+            ks_.push_back(k);
+        }
+        if(ks_.empty()) UNRECOVERABLE_ERROR("NtHashSet requires at least one k");
+        order_.resize(ks_.size());
+        std::iota(order_.begin(), order_.end(), 0u);
+        std::stable_sort(order_.begin(), order_.end(), [&](uint32_t x, uint32_t y) {return ks_[x] < ks_[y];});
+        std::vector<unsigned> sorted;
+        for(const auto i: order_) sorted.push_back(ks_[i]);
+        ks_ = std::move(sorted);
+        u64 ringsz = 1;
+        while(ringsz <= ks_.back()) ringsz <<= 1;
+        mask_ = ringsz - 1;
+        fring_.resize(ringsz);
+        rring_.resize(ringsz);
+    }
+    void scaled(double scale) {fmh_thresh_ = fmh_threshold(scale);}
+    u64 scaled_threshold() const {return fmh_thresh_;}
+    void min_quality(unsigned phred) {
+        if(phred > QualityMask::MAX_PHRED) UNRECOVERABLE_ERROR(std::string("Phred threshold out of range: ") + std::to_string(phred));
+        qmask_.threshold(phred);
+    }
+    unsigned min_quality() const {return qmask_.threshold();}
+    bool canonicalize() const {return canon_;}
+    uint32_t get_mink() const {return ks_.front();}
+    size_t size() const {return ks_.size();}
+    template<typename Functor>
+    void for_each_hash(const Functor &func, const char *s, size_t l) {
+        if(fmh_thresh_ == u64(-1)) {
+            if(canon_) for_each_<true>(func, s, l);
+            else       for_each_<false>(func, s, l);
+        } else {
+            const u64 thresh = fmh_thresh_;
+            auto f = [&func,thresh](u64 x, size_t hi) {if(x <= thresh) func(x, hi);};
+            if(canon_) for_each_<true>(f, s, l);
+            else       for_each_<false>(f, s, l);
+        }
+    }
+    template<typename Functor>
+    void for_each_hash(const Functor &func, kseq_t *ks) {
+        while(kseq_read(ks) >= 0)
+            for_each_hash<Functor>(func, qmask_.apply(ks->seq.s, ks->qual.s, ks->seq.l, ks->qual.l, cstr_lut), ks->seq.l);
+    }
+    template<typename Functor>
+    void for_each_hash(const Functor &func, gzFile fp, kseq_t *ks=nullptr) {
+        bool destroy;
+        if(ks == nullptr) ks = kseq_init(fp), destroy = true;
+        else            kseq_assign(ks, fp), destroy = false;
+        for_each_hash<Functor>(func, ks);
+        if(destroy) kseq_destroy(ks);
+    }
+    template<typename Functor>
+    void for_each_hash(const Functor &func, const char *inpath, kseq_t *ks=nullptr) {
+        if(!with_gzfile(inpath, [&](gzFile fp) {for_each_hash<Functor>(func, fp, ks);}))
+            throw file_open_error(inpath);
+    }
+    // Batched for_each_hash, as for RollingHasherSet: func(KmerSpan<u64>, k_index) per k.
+    template<typename Functor, typename...Args>
+    void for_each_batch(const Functor &func, Args &&...args) {
+        const size_t nh = ks_.size();
+        std::unique_ptr<u64[]> buf(new u64[nh * DEFAULT_BATCH_SIZE]);
+        std::unique_ptr<size_t[]> sizes(new size_t[nh]());
+        for_each_hash([&](u64 x, size_t hi) {
+            u64 *const hbuf = &buf[hi * DEFAULT_BATCH_SIZE];
+            hbuf[sizes[hi]++] = x;
+            if(sizes[hi] == DEFAULT_BATCH_SIZE) {
+                func(KmerSpan<u64>{hbuf, DEFAULT_BATCH_SIZE}, hi);
+                sizes[hi] = 0;
+            }
+        }, std::forward<Args>(args)...);
+        for(size_t hi = 0; hi < nh; ++hi)
+            if(sizes[hi]) func(KmerSpan<u64>{&buf[hi * DEFAULT_BATCH_SIZE], sizes[hi]}, hi);
+    }
+private:
+    template<bool canon, typename Functor>
+    void for_each_(const Functor &func, const char *s, size_t l) {
+        static const std::array<u64, 256> fseeds = make_seed_table(false), rseeds = make_seed_table(true);
+        const size_t nk = ks_.size();
+        const unsigned *const ks = ks_.data();
+        const uint32_t *const order = order_.data();
+        u64 *const fr = fring_.data(), *const rr = rring_.data();
+        u64 P = 0, Q = 0, n = 0; // n: bases since the last ambiguous one
+        size_t nready = 0;       // ks[0, nready) are <= n
+        fr[0] = rr[0] = 0;
+        for(size_t i = 0; i < l; ++i) {
+            const uint8_t c = s[i];
+            if(unlikely(!fseeds[c])) {
+                i = skip_ambiguous_run(s, i + 1, l, cstr_lut) - 1;
+                P = Q = n = nready = 0;
+                fr[0] = rr[0] = 0;
+                continue;
+            }
+            P = rol(P, 1) ^ fseeds[c];
+            CONST_IF(canon) Q ^= rol(rseeds[c], n);
+            ++n;
+            fr[n & mask_] = P;
+            CONST_IF(canon) rr[n & mask_] = Q;
+            while(nready < nk && ks[nready] <= n) ++nready;
+            for(size_t j = 0; j < nready; ++j) {
+                const unsigned k = ks[j];
+                const u64 f = P ^ rol(fr[(n - k) & mask_], k);
+                CONST_IF(canon) {
+                    const u64 r = ror(Q ^ rr[(n - k) & mask_], n - k);
+                    func(std::min(f, r), order[j]);
+                } else func(f, order[j]);
+            }
+        }
+    }
+};
+
+// The multi-k hasher for a hash type: NtHashSet for 64-bit hashes, RollingHasherSet otherwise.
+template<typename IType>
+using MultiKHasher = std::conditional_t<std::is_same<IType, uint64_t>::value, NtHashSet, RollingHasherSet<IType>>;
+
+
+/*
+ * MultiSeedEncoder:
+ * Encodes a set of Spacer-defined seeds in a single scan of each sequence,
+ * sharing the packed character window and the ambiguous-base bookkeeping between seeds.
+ * Seeds are extracted with SpacedGather, as in Encoder's rolling spaced path.
+ * func is called as func(kmer, seed_index), following RollingHasherSet.
+ * Windows of spaced or canonical DNA seeds are filled with every k-mer start position, ambiguous k-mers included,
+ * while those of other unspaced seeds leave ambiguous k-mers out and are flushed at the end of the sequence,
+ * as in the corresponding Encoder paths, so the output for seed i matches Encoder<ScoreType, KmerT>(spacers[i], canonicalize).
+ * Alphabets or combs which can't be packed into 128 bits fall back to one Encoder pass per seed.
+ */
+template<typename ScoreType=score::Lex, typename KmerT=uint64_t>
+class MultiSeedEncoder {
+    static_assert(!std::is_same<ScoreType, score::Entropy>::value, "Entropy scoring requires per-seed encoding");
+    std::vector<Spacer> sps_;
+    std::vector<SpacedGather> gathers_;
+    std::vector<QueueMap<KmerT, KmerT>> qmaps_;
+    void *data_;
+    const ScoreType scorer_;
+    bool canonicalize_;
+    InputType rht = InputType::DNA;
+    const int8_t *lutptr = (const int8_t *)DNA4.data();
+    unsigned maxc_ = 0;
+public:
+    static constexpr KmerT ENCODE_OVERFLOW = static_cast<KmerT>(-1);
+    MultiSeedEncoder(const std::vector<Spacer> &sps, void *data, bool canonicalize=true):
+        sps_(sps), data_(data), scorer_{}, canonicalize_(canonicalize)
+    {
+        if(sps_.empty()) throw std::invalid_argument("MultiSeedEncoder requires at least one Spacer");
+        qmaps_.reserve(sps_.size());
+        for(const auto &sp: sps_) {
+            qmaps_.emplace_back(sp.w_ - sp.c_ + 1);
+            maxc_ = std::max(maxc_, sp.c_);
+        }
+        build_gathers();
+    }
+    MultiSeedEncoder(const std::vector<Spacer> &sps, bool canonicalize=true): MultiSeedEncoder(sps, nullptr, canonicalize) {}
+    void hashtype(RollingHashType newrht) {
+        rht = newrht; lutptr = rh2lp(rht);
+        build_gathers();
+    }
+    RollingHashType hashtype() const {return rht;}
+    size_t size() const {return sps_.size();}
+    const Spacer &spacer(size_t i) const {return sps_[i];}
+    bool canonicalize() const {return canonicalize_;}
+    void canonicalize(bool value) {canonicalize_ = value;}
+    // Whether all seeds are encoded in one shared pass, rather than falling back to one Encoder per seed.
+    bool single_pass() const {return !gathers_.empty();}
+
+    template<typename Functor>
+    INLINE void for_each(const Functor &func, const char *s, u64 l) {
+        if(!single_pass()) {
+            for(size_t i = 0; i < sps_.size(); ++i) {
+                Encoder<ScoreType, KmerT> enc(sps_[i], data_, canonicalize_);
+                enc.hashtype(rht);
+                enc.for_each([&func,i](KmerT km) {func(km, i);}, s, l);
+            }
+            return;
+        }
+        if(maxc_ * gathers_.front().nbits_ <= 64) for_each_rolling_<u64>(func, s, l);
+        else                                      for_each_rolling_<u128>(func, s, l);
+    }
+    template<typename Functor>
+    INLINE void for_each(const Functor &func, kseq_t *ks) {
+        while(kseq_read(ks) >= 0) for_each<Functor>(func, ks->seq.s, ks->seq.l);
+    }
+    template<typename Functor>
+    INLINE void for_each(const Functor &func, gzFile fp, kseq_t *ks=nullptr) {
+        bool destroy;
+        if(ks == nullptr) ks = kseq_init(fp), destroy = true;
+        else            kseq_assign(ks, fp), destroy = false;
+        for_each<Functor>(func, ks);
+        if(destroy) kseq_destroy(ks);
+    }
+    template<typename Functor>
+    INLINE void for_each(const Functor &func, const std::string &path, kseq_t *ks=nullptr) {
+        for_each(func, path.data(), ks);
+    }
+    template<typename Functor>
+    void for_each(const Functor &func, const char *path, kseq_t *ks=nullptr) {
+        if(!with_gzfile(path, [&](gzFile fp) {for_each<Functor>(func, fp, ks);}))
+            UNRECOVERABLE_ERROR(ks::sprintf("Could not open file at %s. Abort!\n", path).data());
+    }
+private:
+    void build_gathers() {
+        gathers_.clear();
+        unsigned nb;
+        switch(rht) {
+            case DNA: nb = 2; break;
+            case DNA2: case DNAC: nb = 1; break;
+            case PROTEIN_3BIT: nb = 3; break;
+            case PROTEIN: nb = 8; break;
+            default: return;
+        }
+        if(!std::all_of(sps_.begin(), sps_.end(), [nb](const Spacer &sp) {return SpacedGather::usable(sp, nb);})) return;
+        gathers_.reserve(sps_.size());
+        for(const auto &sp: sps_) gathers_.emplace_back(sp, nb);
+    }
+    template<typename WindowT, typename Functor>
+    INLINE void for_each_rolling_(const Functor &func, const char *s, u64 l) {
+        const size_t nseeds = sps_.size();
+        const unsigned nb = gathers_.front().nbits_;
+        const WindowT winmask = maxc_ * nb == sizeof(WindowT) * CHAR_BIT ? WindowT(-1): (WindowT(1) << (maxc_ * nb)) - 1;
+        for(auto &q: qmaps_) q.reset();
+        const bool stranded = !(canonicalize_ && rht == DNA);
+        WindowT window = 0;
+        u64 badwin = 0;
+        for(u64 i = 0; i < l; ++i) {
+            const int8_t nv = lutptr[static_cast<uint8_t>(s[i])];
+            const bool bad = nv == int8_t(-1);
+            window = ((window << nb) | static_cast<WindowT>(bad ? 0: static_cast<uint8_t>(nv))) & winmask;
+            badwin = (badwin << 1) | bad;
+            for(size_t si = 0; si < nseeds; ++si) {
+                const Spacer &sp = sps_[si];
+                if(i + 1 < sp.c_) continue;
+                const SpacedGather &g = gathers_[si];
+                KmerT km = badwin & g.charmask_ ? ENCODE_OVERFLOW: g.extract<KmerT>(window);
+                if(km != ENCODE_OVERFLOW && canonicalize_ && rht == DNA && sp.unspaced())
+                    km = canonical_representation(km, sp.k_);
+                if(!sp.unwindowed()) {
+                    if(km == ENCODE_OVERFLOW && stranded && sp.unspaced()) continue;
+                    auto &q = qmaps_[si];
+                    km = q.next_value(km, scorer_(km, data_));
+                }
+                if(km != ENCODE_OVERFLOW) func(km, si);
+            }
+        }
+        if(stranded)
+            for(size_t si = 0; si < nseeds; ++si)
+                if(sps_[si].unspaced() && !sps_[si].unwindowed() && qmaps_[si].partially_full())
+                    func(qmaps_[si].max_in_queue().el_, si);
+    }
+};
 
 template<typename ScoreType, typename KhashType>
 void add_to_khash(KhashType *kh, Encoder<ScoreType> &enc, kseq_t *ks) {
@@ -1026,9 +2377,10 @@ void add_to_khash(KhashType *kh, Encoder<ScoreType> &enc, kseq_t *ks) {
     } else {
         while(kseq_read(ks) >= 0) {
             enc.assign(ks);
+            u64 last = BF;
             while(enc.has_next_kmer())
-                if((min = enc.next_minimizer()) != BF)
-                    khash_put(kh, min, &khr);
+                if((min = enc.next_minimizer()) != BF && min != last) // Skip repeats within a super-k-mer
+                    khash_put(kh, last = min, &khr);
         }
     }
 }
@@ -1040,7 +2392,11 @@ khash_t(all) *hashcount_lmers(const std::string &path, const Spacer &space,
 
     Encoder<ScoreType> enc(nullptr, 0, space, data, canonicalize);
     khash_t(all) *ret(kh_init(all));
-    enc.for_each([ret](auto x) {int khr; auto it = kh_get(all, ret, x); if(it == ret->n_buckets) {kh_put(all, ret, x, &khr); if(khr < 0) throw std::runtime_error("Error adding to hash table");}}
+    u64 last = BF;
+    enc.for_each([ret,&last](auto x) {
+        if(x == last) return; // Repeated minimizer within a super-k-mer
+        last = x;
+        int khr; auto it = kh_get(all, ret, x); if(it == ret->n_buckets) {kh_put(all, ret, x, &khr); if(khr < 0) throw std::runtime_error("Error adding to hash table");}}
                  , path.data());
     return ret;
 }
@@ -1,50 +1,65 @@
 #pragma once
-#include "hll/include/circularqueue/cq.h"
+#include <cmath>
+#include <cstring>
+#include <vector>
 #include "bonsai/kmerutil.h"
-#include "hll/include/flat_hash_map/flat_hash_map.hpp"
 #include "bonsai/rhtraits.h"
 
 namespace bns {
 
+/*
+ * CircusEnt: Shannon entropy (as sum p log p) of the symbols in a sliding window of size qsz.
+ * Counts are kept in a fixed array indexed by the encoded symbol, and the running sum of
+ * n log n over those counts is updated on each push from a table of n log n for n in [0, qsz].
+ * The table is stored in fixed point so that the running sum is exact and does not drift,
+ * so push and value are O(1) without any logarithms.
+ */
 class CircusEnt {
-    using CountT = uint64_t;
-    circ::deque<char> q_;
+    using CountT = uint32_t;
+    static constexpr double FIXED_SCALE = 4294967296.; // 2^32
+    std::vector<uint8_t> q_;      // Ring buffer of symbols in the window
+    std::vector<CountT>  counts_; // Indexed by symbol
+    std::vector<int64_t> nlogn_;  // n log n * FIXED_SCALE, for n in [0, qsz]
+    size_t        head_;
     size_t        cqsz_;
     const size_t   qsz_;
     const double qszinv_;
-    ska::flat_hash_map<char, size_t> counts_;
+    const double logqsz_;
+    int64_t       sum_;           // Sum of nlogn_[count] over all symbols
 public:
     static constexpr double NOT_FULL = -1.;
-    CircusEnt(size_t qsz): q_(qsz), cqsz_(0), qsz_(qsz), qszinv_(1./qsz)
-    {}
-    CircusEnt(const CircusEnt &other): q_(other.q_), cqsz_(other.cqsz_), qsz_(other.qsz_), qszinv_(other.qszinv_), counts_(other.counts_)
-    {}
+    CircusEnt(size_t qsz): q_(qsz), counts_(256), nlogn_(qsz + 1), head_(0), cqsz_(0), qsz_(qsz), qszinv_(1./qsz), logqsz_(std::log(double(qsz))), sum_(0)
+    {
+        for(size_t i = 1; i <= qsz_; ++i)
+            nlogn_[i] = std::llround(i * std::log(double(i)) * FIXED_SCALE);
+    }
+    CircusEnt(const CircusEnt &other) = default;
     CircusEnt(CircusEnt &&other) = default;
     void clear() {
-        counts_.clear();
-        cqsz_ = 0;
-        q_.clear();
+        // Only symbols still in the window can have non-zero counts.
+        for(size_t i = 0; i < cqsz_; ++i) counts_[q_[i]] = 0;
+        head_ = cqsz_ = 0;
+        sum_ = 0;
     }
     void push(char c) {
-        // Increment count of added nucleotide
-        // If not full
-        auto it = counts_.find(c);
-        if(it == counts_.end()) it = counts_.emplace(c, 1).first;
-        else ++it->second;
+        const uint8_t sym = c;
         if(cqsz_ == qsz_) {
-            it = counts_.find(q_.pop());
-            assert(it != counts_.end());
-            if(--it->second == 0)
-                counts_.erase(it);
             // Pop and decrement
-        } else
-            ++cqsz_; // Or just keep filling the window
-        q_.push(c);
+            const uint8_t old = q_[head_];
+            CountT &oc = counts_[old];
+            sum_ += nlogn_[oc - 1] - nlogn_[oc];
+            --oc;
+        } else ++cqsz_; // Or just keep filling the window
+        CountT &nc = counts_[sym];
+        sum_ += nlogn_[nc + 1] - nlogn_[nc];
+        ++nc;
+        q_[head_] = sym;
+        if(++head_ == qsz_) head_ = 0;
     }
     double value() const {
         if(unlikely(cqsz_ < qsz_)) return NOT_FULL;
-        return std::accumulate(counts_.begin(), counts_.end(), 0.,
-               [qi=qszinv_](double s, auto v) {return s + v.second * qi * std::log(v.second * qi);});
+        // sum_i (c_i / q) log(c_i / q) = (sum_i c_i log c_i) / q - log q
+        return sum_ * (qszinv_ / FIXED_SCALE) - logqsz_;
     }
     double next_ent(char c) {
         push(c);
@@ -52,4 +67,40 @@ public:
     }
 };
 
+/*
+ * DustWindow: the symmetric DUST score (as in sdust) of the last w bases, updated per base in O(1).
+ * Triplet counts are kept over the window alongside r, the sum over triplets of c (c - 1) / 2,
+ * which is adjusted by the count being incremented or decremented as triplets enter and leave.
+ * The window is low-complexity if 10 r > level * l, l being the number of triplets in it;
+ * level 20 (the sdust and dustmasker default) catches poly-A, microsatellites and short tandem repeats.
+ */
+class DustWindow {
+    std::vector<uint8_t> q_; // Ring buffer of triplets in the window
+    uint32_t counts_[64];
+    size_t head_, n_;
+    uint32_t trip_, nbases_;
+    uint64_t r_;
+    unsigned level_;
+public:
+    static constexpr unsigned DEFAULT_WINDOW = 64, DEFAULT_LEVEL = 20;
+    DustWindow(unsigned level=DEFAULT_LEVEL, unsigned w=DEFAULT_WINDOW): q_(w > 3 ? w - 2: 1), level_(level) {clear();}
+    void clear() {
+        std::memset(counts_, 0, sizeof(counts_));
+        head_ = n_ = 0; trip_ = nbases_ = 0; r_ = 0;
+    }
+    // Pushes a 2-bit base code.
+    void push(unsigned c) {
+        trip_ = ((trip_ << 2) | c) & 63u;
+        if(++nbases_ < 3) return;
+        if(n_ == q_.size()) r_ -= --counts_[q_[head_]];
+        else ++n_;
+        r_ += counts_[trip_]++;
+        q_[head_] = trip_;
+        if(++head_ == q_.size()) head_ = 0;
+    }
+    bool low_complexity() const {return r_ * 10 > uint64_t(level_) * n_;}
+    unsigned level() const {return level_;}
+    unsigned window() const {return q_.size() + 2;}
+};
+
 } // namespace bns
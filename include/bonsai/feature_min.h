@@ -65,18 +65,24 @@ struct MinMap {
 };
 
 template<typename ScoreType>
-size_t fill_set_genome(const char *path, const Spacer &sp, khash_t(all) *ret, size_t index, void *data, bool canon, kseq_t *ks=nullptr) {
+size_t fill_set_genome(const char *path, const Spacer &sp, khash_t(all) *ret, size_t index, void *data, bool canon, kseq_t *ks=nullptr, bool hpc=false, unsigned dust=0, unsigned nthreads=1) {
     LOG_ASSERT(ret);
     LOG_DEBUG("Filling from genome at path %s. kseq is pre-allocated ? %s. %p\n", path, ks ? "true": "false", (void *)ks);
 
     Encoder<ScoreType> enc(0, 0, sp, data, canon);
-    enc.for_each([&](auto x) {
+    enc.homopolymer_compress(hpc);
+    if(dust) enc.dust(dust);
+    u64 last = BF;
+    // for_each_parallel keeps the serial order, so repeated minimizers stay adjacent.
+    enc.for_each_parallel([&](auto x) {
+        if(x == last) return; // Consecutive windows of a super-k-mer repeat their minimizer
+        last = x;
         auto it = kh_get(all, ret, x);
         if(it == kh_end(ret)) {
             int khr;
             kh_put(all, ret, x, &khr);
         }
-    }, path, ks);
+    }, path, nthreads, ks);
     LOG_DEBUG("Set of size %lu filled from genome at path %s\n", kh_size(ret), path);
     return index;
 }
@@ -92,7 +98,7 @@ size_t fill_set_genome_container(Container &container, const Spacer &sp, khash_t
 
 template<typename ScoreType, typename MapUpdater>
 typename MapUpdater::ReturnType
-make_map(const std::vector<std::string> fns, const khash_t(p) *tax_map, const char *seq2tax_path, const Spacer &sp, int num_threads, bool canon, size_t start_size, const khash_t(64) *data) {
+make_map(const std::vector<std::string> fns, const khash_t(p) *tax_map, const char *seq2tax_path, const Spacer &sp, int num_threads, bool canon, size_t start_size, const khash_t(64) *data, bool hpc=false, unsigned dust=0) {
     MapUpdater mu;
 
     khash_t(c) *r32 = nullptr;
@@ -115,13 +121,15 @@ make_map(const std::vector<std::string> fns, const khash_t(p) *tax_map, const ch
     // Mkae the future return the kseq pointer and then use it for resubmission.
     // TODO: Also use a fixed st of kh_all sets to reduce memory allocations.
     KSeqBufferHolder kseqs(num_threads);
+    // With fewer genomes than threads, the spare threads encode within each genome.
+    const unsigned per_genome = todo && todo < size_t(num_threads) ? num_threads / todo : 1;
     std::vector<uint32_t> counter_map;
 
     // Submit the first set of jobs
     std::set<size_t> used;
     for(size_t i(0); i < (unsigned)num_threads && i < todo; ++i) {
         futures.emplace_back(std::async(
-          std::launch::async, fill_set_genome<ScoreType>, fns[i].data(), sp, counters.data() + i, i, (void *)data, canon, kseqs.data() + submitted));
+          std::launch::async, fill_set_genome<ScoreType>, fns[i].data(), sp, counters.data() + i, i, (void *)data, canon, kseqs.data() + submitted, hpc, dust, per_genome));
         counter_map.emplace_back(submitted);
         LOG_DEBUG("Submitted for %zu.\n", submitted);
         ++submitted;
@@ -141,7 +149,7 @@ make_map(const std::vector<std::string> fns, const khash_t(p) *tax_map, const ch
             kseq_t *ks_to_submit = kseqs.data() + coffset;
             f = std::async(
               std::launch::async, fill_set_genome<ScoreType>, fns[submitted].data(),
-              sp, counter, submitted, (void *)data, canon, ks_to_submit);
+              sp, counter, submitted, (void *)data, canon, ks_to_submit, hpc, dust, per_genome);
             counter_map.emplace_back(coffset);
             ++submitted, ++completed;
             LOG_DEBUG("Have now submitted %zu element\n", submitted);
@@ -178,15 +186,15 @@ auto feature_count_map(const std::vector<std::string> fns, const khash_t(p) *tax
 template<typename ScoreType>
 khash_t(c) *lca_map(const std::vector<std::string> &fns, const khash_t(p) *tax_map,
                     const char *seq2tax_path,
-                    const Spacer &sp, int num_threads, bool canon, size_t start_size) {
-    return make_map<ScoreType, LcaMap>(fns, tax_map, seq2tax_path, sp, num_threads, canon, start_size, nullptr);
+                    const Spacer &sp, int num_threads, bool canon, size_t start_size, bool hpc=false, unsigned dust=0) {
+    return make_map<ScoreType, LcaMap>(fns, tax_map, seq2tax_path, sp, num_threads, canon, start_size, nullptr, hpc, dust);
 }
 
 template<typename ScoreType>
 khash_t(c) *minimized_map(std::vector<std::string> fns,
                           const khash_t(64) *full_map, const char *seq2tax_path, const khash_t(p) *tax_map,
-                          const Spacer &sp, int num_threads, size_t start_size, bool canon) {
-    return make_map<ScoreType, MinMap>(fns, tax_map, seq2tax_path, sp, num_threads, canon, start_size, full_map);
+                          const Spacer &sp, int num_threads, size_t start_size, bool canon, bool hpc=false, unsigned dust=0) {
+    return make_map<ScoreType, MinMap>(fns, tax_map, seq2tax_path, sp, num_threads, canon, start_size, full_map, hpc, dust);
 }
 
 template<typename ScoreType>
@@ -32,8 +32,9 @@ public:
         while(kseq_read(ks) >= 0) {
             cds_.emplace_back(ks, chunk_sz_, p, estim, jestim);
             auto &cd = cds_.back();
-            enc.for_each([&](const u64 &kmer) {cd.hlls_[size_t(enc.pos() * csinv)].addh(kmer);},
-                         ks->seq.s, ks->seq.l);
+            // Spaced (or canonical windowed) seeds take start from pos(), as for_each_with_pos falls back to.
+            enc.for_each_with_pos([&](u64 kmer, u64 start, bool) {cd.hlls_[size_t(start * csinv)].addh(kmer);},
+                                  ks->seq.s, ks->seq.l);
         }
         gzclose(fp);
         if(destroy) kseq_destroy(ks);
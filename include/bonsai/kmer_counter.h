@@ -16,7 +16,7 @@ KHASH_SET_INIT_INT64(i16s)
 template<typename C, typename IT=uint64_t, typename ArgType>
 std::vector<khash_t(i16)> build_kmer_counts(const C &kmer_sizes, ArgType fp, bool canon=false, size_t presize=0) {
     static_assert(std::is_same<ArgType, gzFile>::value  || std::is_same<ArgType, char *>::value || std::is_same<ArgType, const char *>::value, "Must be gzFile, char *, or const char *");
-    bns::RollingHasherSet<IT> rhs(kmer_sizes, canon);
+    bns::MultiKHasher<IT> rhs(kmer_sizes, canon);
     using T = khash_t(i16);
     std::vector<T> kmer_maps(kmer_sizes.size());
     std::memset(&kmer_maps[0], 0, sizeof(kmer_maps[0]) * kmer_sizes.size());
@@ -45,7 +45,7 @@ std::vector<khash_t(i16)> build_kmer_counts(const C &kmer_sizes, ArgType fp, boo
 template<typename C, typename IT=uint64_t, typename ArgType,typename Allocator=sketch::Allocator<IT>>
 std::vector<std::vector<IT, Allocator>> build_kmer_sets(const C &kmer_sizes, ArgType fp, bool canon=false, size_t presize=0) {
     static_assert(std::is_same<ArgType, gzFile>::value  || std::is_same<ArgType, char *>::value || std::is_same<ArgType, const char *>::value, "Must be gzFile, char *, or const char *");
-    bns::RollingHasherSet<IT> rhs(kmer_sizes, canon);
+    bns::MultiKHasher<IT> rhs(kmer_sizes, canon);
     using T = std::vector<IT, Allocator>;
     std::vector<T> kmer_sets(kmer_sizes.size());
     if(presize)
@@ -32,30 +32,19 @@ struct KmerIdx {
             comments_.emplace_back(ks->comment.s);
         else comments_.emplace_back();
         seqlens_.emplace_back(ks->seq.l);
-        IT1 position_increment = cm_seqs_.back();
+        const IT1 position_increment = cm_seqs_.back();
         cm_seqs_.emplace_back(cm_seqs_.back() + ks->seq.l);
-        KmerType kmer = 0;
-        const KmerType mask = ((1ull << k_) - 1);
-        const char *s = ks->seq.s, *e = ks->seq.s + ks->seq.l;
-        unsigned nfilled = 0;
-        while(s < e) {
-            kmer <<= 2;
-            if((kmer |= cstr_lut[*s]) == BAD_KMER && *s != 'T') {
-                s += k_;
-                kmer = 0;
-                continue;
-            }
-            if(++nfilled == k_) {
-                kmer &= mask;
-                IT1 diff = s - ks->seq.s;
-                auto it = map_.find(kmer);
-                if(it == map_.end()) {
-                    map_.emplace(kmer, lazy::vector<IT1>{diff + position_increment});
-                } else it->second.emplace_back(diff + position_increment);
-                --nfilled;
-            }
-            ++s;
-        }
+        // Positions are those of each k-mer's last base in the concatenated sequences.
+        // k <= 4 * sizeof(KmerType), so 64-bit k-mers fit in KmerType.
+        Encoder<score::Lex> enc(Spacer(k_), false);
+        enc.for_each_with_pos([&](u64 km, u64 start, bool) {
+            const KmerType kmer = km;
+            const IT1 pos = start + k_ - 1 + position_increment;
+            auto it = map_.find(kmer);
+            if(it == map_.end()) {
+                map_.emplace(kmer, lazy::vector<IT1>{pos});
+            } else it->second.emplace_back(pos);
+        }, ks->seq.s, ks->seq.l);
     }
     void make_idx(const char *path) {
         gzFile fp = gzopen(path, "rb");
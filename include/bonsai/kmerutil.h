@@ -138,6 +138,14 @@ static INLINE u64 canonical_representation(u64 kmer, uint8_t n) {
     const u64 revcom(reverse_complement(kmer, n));
     return kmer < revcom ? kmer : revcom;
 }
+static INLINE u128 reverse_complement(u128 kmer, uint8_t n) {
+    const u128 full((u128(reverse_complement(static_cast<u64>(kmer), 32)) << 64) | reverse_complement(static_cast<u64>(kmer >> 64), 32));
+    return full >> (128 - (n << 1));
+}
+static INLINE u128 canonical_representation(u128 kmer, uint8_t n) {
+    const u128 revcom(reverse_complement(kmer, n));
+    return kmer < revcom ? kmer : revcom;
+}
 static INLINE bool canonicalize(u64 &kmer, uint8_t n) {
     const u64 revcom(reverse_complement(kmer, n));
     if(kmer < revcom) return false;
@@ -145,6 +153,43 @@ static INLINE bool canonicalize(u64 &kmer, uint8_t n) {
     return true;
 }
 
+/*
+ * Kmer128: a 16-byte k-mer key with 8-byte alignment.
+ * A (Kmer128, u32) pair takes 24 bytes instead of the 32 a __uint128_t key needs, so a ska::flat_hash_map
+ * slot, which prepends a distance byte, takes 32 bytes instead of 48.
+ */
+struct Kmer128 {
+    u64 lo_, hi_;
+    Kmer128() = default;
+    Kmer128(u128 x): lo_(static_cast<u64>(x)), hi_(static_cast<u64>(x >> 64)) {}
+    operator u128() const {return (u128(hi_) << 64) | lo_;}
+    bool operator==(const Kmer128 &o) const {return lo_ == o.lo_ && hi_ == o.hi_;}
+    bool operator!=(const Kmer128 &o) const {return !(*this == o);}
+    bool operator<(const Kmer128 &o) const {return hi_ != o.hi_ ? hi_ < o.hi_: lo_ < o.lo_;}
+};
+static_assert(sizeof(Kmer128) == 16 && alignof(Kmer128) == 8, "Kmer128 must be a packed 16-byte key");
+
+// Folds a 128-bit k-mer into 64 bits (murmur3 finalizer over both halves) for hash tables and sketches keyed on u64.
+static INLINE u64 fold128(u64 lo, u64 hi) {
+    u64 h = lo ^ ((hi << 31) | (hi >> 33)) * 0x9E3779B97F4A7C15ull;
+    h ^= h >> 33; h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ull;
+    return h ^ (h >> 33);
+}
+static INLINE u64 fold128(u128 x) {return fold128(static_cast<u64>(x), static_cast<u64>(x >> 64));}
+struct Kmer128Hash {
+    size_t operator()(const Kmer128 &x) const {return fold128(x.lo_, x.hi_);}
+};
+
+// Decimal representation of a 128-bit k-mer, for text output.
+inline std::string to_string(u128 x) {
+    if(x <= u128(std::numeric_limits<u64>::max())) return std::to_string(static_cast<u64>(x));
+    char buf[40], *p = buf + sizeof(buf);
+    *--p = '\0';
+    do *--p = '0' + static_cast<int>(x % 10); while(x /= 10);
+    return std::string(p);
+}
+
 } // namespace bns
 
 #endif //ifndef _KMER_UTIL_H__
@@ -23,7 +23,13 @@
 #  define KSTREAM_SIZE (65536u)
 #endif
 
+#ifdef __cplusplus
+// Reads through ReadAhead, which serves gzFiles being read ahead on a helper thread and calls gzread for the rest.
+#  include "readahead.h"
+KSEQ_INIT_SIZE(gzFile, bns::ReadAhead::read, KSTREAM_SIZE)
+#else
 KSEQ_INIT_SIZE(gzFile, gzread, KSTREAM_SIZE)
+#endif
 
 #ifndef INLINE
 #  if __GNUC__ || __clang__
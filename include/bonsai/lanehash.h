@@ -0,0 +1,150 @@
+#ifndef BNS_LANEHASH_H__
+#define BNS_LANEHASH_H__
+#include <cstdint>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+#endif
+
+namespace bns {
+
+#if __AVX2__
+/*
+ * Multi-read cyclic (buzhash) rolling hashing.
+ * CyclicHash advances one read at a time through a chain of dependent rotates and table lookups.
+ * LaneCyclicHash instead advances LANES reads at once, one per 64-bit vector lane (8 with AVX-512, 4 with AVX2),
+ * so that short reads use the full vector width.
+ * Each lane keeps the forward hash of its current k-mer and, if canonicalizing (DNA only),
+ * the hash of its reverse complement under a second table, matching RollingHasher's hasher_ and rchasher_.
+ *
+ * Callers write lane_code(c) for the symbol code c entering lane j at step t to codes(t)[j],
+ * for up to BLOCK steps past step(), then call step_block.
+ * Lane codes stay in a ring for k more steps, where they are read again as they leave the window.
+ * Negative codes (ambiguous or masked bases, or padding for idle lanes) reset a lane.
+ * Tables of up to 4 (AVX2) or 8 (AVX-512) symbols are looked up by in-register permutes, larger ones by gathers.
+ */
+struct LaneCyclicHash {
+#if __AVX512F__
+    static constexpr unsigned LANES = 8;
+#else
+    static constexpr unsigned LANES = 4;
+#endif
+    static constexpr unsigned BLOCK = 64; // Maximum steps per call to step_block
+private:
+    const uint64_t *fwd_; // 256-entry character table
+    uint64_t k_;
+    unsigned rot_;  // k % 64: the rotation of the base leaving the window
+    bool perm_, canon_;
+    uint64_t step_ = 0, mask_;
+    std::vector<int64_t> ring_; // codes(t) for the last mask_ + 1 steps
+    // Permute tables: AVX-512 indexes 64-bit entries by the low 3 bits of a lane code,
+    // AVX2 32-bit entries by its halves (c, c + 4), so the low words of entries come first, then the high words.
+    alignas(64) uint32_t ftab_[16], rtab_[16];
+    alignas(64) uint64_t h_[LANES], hr_[LANES], nf_[LANES];
+public:
+    alignas(64) uint64_t hashes_[BLOCK * LANES], rchashes_[BLOCK * LANES];
+    uint32_t full_[BLOCK]; // Bit j is set if lane j held a full k-mer after step step() + t
+
+    // Low 32 bits: c, for gathers and AVX-512 permutes; high 32 bits: c + 4, for AVX2 permutes.
+    static int64_t lane_code(int c) {return c < 0 ? int64_t(-1): int64_t(c) | (int64_t(c + 4) << 32);}
+
+    // rev is only read if canonicalizing, which requires A, C, G and T to have codes 0-3.
+    LaneCyclicHash(const uint64_t *fwd, const uint64_t *rev, uint64_t k, unsigned nsym, bool canon):
+        fwd_(fwd), k_(k), rot_(k % 64), perm_(nsym <= (LANES == 8 ? 8: 4)), canon_(canon)
+    {
+        uint64_t ringsz = 1;
+        while(ringsz < k + BLOCK) ringsz <<= 1;
+        mask_ = ringsz - 1;
+        ring_.resize(ringsz * LANES);
+        for(unsigned c = 0; c < 8; ++c) {
+            // The reverse table is stored complemented, so both strands look up the same lane code.
+            const uint64_t f = fwd[c], r = canon && c < 4 ? rev[3 - c]: 0;
+#if __AVX512F__
+            ftab_[2 * c] = uint32_t(f); ftab_[2 * c + 1] = uint32_t(f >> 32);
+            rtab_[2 * c] = uint32_t(r); rtab_[2 * c + 1] = uint32_t(r >> 32);
+#else
+            if(c >= 4) break;
+            ftab_[c] = uint32_t(f); ftab_[c + 4] = uint32_t(f >> 32);
+            rtab_[c] = uint32_t(r); rtab_[c + 4] = uint32_t(r >> 32);
+#endif
+        }
+        for(unsigned j = 0; j < LANES; ++j) reset_lane(j);
+    }
+    void reset_lane(unsigned j) {h_[j] = hr_[j] = nf_[j] = 0;}
+    uint64_t step() const {return step_;}
+    int64_t *codes(uint64_t t) {return &ring_[(t & mask_) * LANES];}
+
+    // Advances every lane by nsteps <= BLOCK codes, filling hashes_, rchashes_ (if canonicalizing) and full_.
+    void step_block(unsigned nsteps) {
+        const uint64_t t0 = step_;
+        step_ += nsteps;
+#if __AVX512F__
+        const __m512i k = _mm512_set1_epi64(k_), one = _mm512_set1_epi64(1), rotv = _mm512_set1_epi64(rot_);
+        __m512i h = _mm512_load_si512(h_), hr = _mm512_load_si512(hr_), nf = _mm512_load_si512(nf_);
+        const __m512i ft = _mm512_load_si512(ftab_), rt = _mm512_load_si512(rtab_);
+        auto lookup = [this,&ft](__m512i idx) {
+            return perm_ ? _mm512_permutexvar_epi64(idx, ft)
+                         : _mm512_i64gather_epi64(_mm512_and_si512(idx, _mm512_set1_epi64(0xFF)), fwd_, 8);
+        };
+        for(unsigned t = 0; t < nsteps; ++t) {
+            const __m512i ci = _mm512_loadu_si512(codes(t0 + t)), co = _mm512_loadu_si512(codes(t0 + t - k_));
+            const __mmask8 valid = _mm512_cmpge_epi64_mask(ci, _mm512_setzero_si512());
+            const __mmask8 full = _mm512_cmpge_epu64_mask(nf, k);
+            const __m512i hout = _mm512_rolv_epi64(_mm512_maskz_mov_epi64(full, lookup(co)), rotv);
+            h = _mm512_maskz_mov_epi64(valid, _mm512_ternarylogic_epi64(_mm512_rol_epi64(h, 1), hout, lookup(ci), 0x96));
+            if(canon_) {
+                const __m512i rin = _mm512_rolv_epi64(_mm512_permutexvar_epi64(ci, rt), rotv);
+                const __m512i rout = _mm512_maskz_permutexvar_epi64(full, co, rt);
+                hr = _mm512_maskz_mov_epi64(valid, _mm512_ror_epi64(_mm512_ternarylogic_epi64(hr, rin, rout, 0x96), 1));
+                _mm512_store_si512(rchashes_ + t * LANES, hr);
+            }
+            nf = _mm512_maskz_add_epi64(valid, nf, one);
+            _mm512_store_si512(hashes_ + t * LANES, h);
+            full_[t] = _mm512_cmpge_epu64_mask(nf, k);
+        }
+        _mm512_store_si512(h_, h); _mm512_store_si512(hr_, hr); _mm512_store_si512(nf_, nf);
+#else
+        // Unsigned comparisons against k by way of flipping the sign bit
+        const __m256i sign = _mm256_set1_epi64x(INT64_MIN), km1 = _mm256_set1_epi64x((k_ - 1) ^ uint64_t(INT64_MIN));
+        const __m256i one = _mm256_set1_epi64x(1);
+        __m256i h = _mm256_load_si256(reinterpret_cast<const __m256i *>(h_)),
+                hr = _mm256_load_si256(reinterpret_cast<const __m256i *>(hr_)),
+                nf = _mm256_load_si256(reinterpret_cast<const __m256i *>(nf_));
+        const __m256i ft = _mm256_load_si256(reinterpret_cast<const __m256i *>(ftab_)),
+                      rt = _mm256_load_si256(reinterpret_cast<const __m256i *>(rtab_));
+        const __m128i rotl_n = _mm_cvtsi32_si128(rot_), rotr_n = _mm_cvtsi32_si128(64 - rot_);
+        auto lookup = [this,&ft](__m256i idx) {
+            return perm_ ? _mm256_permutevar8x32_epi32(ft, idx)
+                         : _mm256_i64gather_epi64(reinterpret_cast<const long long *>(fwd_), _mm256_and_si256(idx, _mm256_set1_epi64x(0xFF)), 8);
+        };
+        auto rotk = [&](__m256i x) {return _mm256_or_si256(_mm256_sll_epi64(x, rotl_n), _mm256_srl_epi64(x, rotr_n));};
+        for(unsigned t = 0; t < nsteps; ++t) {
+            const __m256i ci = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(codes(t0 + t))),
+                          co = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(codes(t0 + t - k_)));
+            const __m256i valid = _mm256_cmpgt_epi64(ci, _mm256_set1_epi64x(-1));
+            const __m256i full = _mm256_cmpgt_epi64(_mm256_xor_si256(nf, sign), km1);
+            const __m256i hout = rotk(_mm256_and_si256(full, lookup(co)));
+            const __m256i hrot = _mm256_or_si256(_mm256_slli_epi64(h, 1), _mm256_srli_epi64(h, 63));
+            h = _mm256_and_si256(valid, _mm256_xor_si256(_mm256_xor_si256(hrot, hout), lookup(ci)));
+            if(canon_) {
+                const __m256i rin = rotk(_mm256_permutevar8x32_epi32(rt, ci));
+                const __m256i rout = _mm256_and_si256(full, _mm256_permutevar8x32_epi32(rt, co));
+                const __m256i x = _mm256_xor_si256(_mm256_xor_si256(hr, rin), rout);
+                hr = _mm256_and_si256(valid, _mm256_or_si256(_mm256_srli_epi64(x, 1), _mm256_slli_epi64(x, 63)));
+                _mm256_store_si256(reinterpret_cast<__m256i *>(rchashes_ + t * LANES), hr);
+            }
+            nf = _mm256_and_si256(valid, _mm256_add_epi64(nf, one));
+            _mm256_store_si256(reinterpret_cast<__m256i *>(hashes_ + t * LANES), h);
+            full_[t] = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(_mm256_xor_si256(nf, sign), km1)));
+        }
+        _mm256_store_si256(reinterpret_cast<__m256i *>(h_), h);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(hr_), hr);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(nf_), nf);
+#endif
+    }
+};
+#endif /* __AVX2__ */
+
+} // namespace bns
+
+#endif /* BNS_LANEHASH_H__ */
@@ -4,8 +4,6 @@
 #include <cstdint>
 #include <cstdio>
 #include <cinttypes>
-#include "btree/map.h"
-#include "hll/include/circularqueue/cq.h"
 #include <vector>
 
 #include "bonsai/util.h"
@@ -29,72 +27,70 @@ struct ElScore {
 };
 
 
+/*
+ * QueueMap: sliding-window minimum over (score, element) pairs.
+ * Implemented as an ascending-minima deque in a power-of-two ring buffer:
+ * each pushed pair evicts every queued pair which does not score strictly better,
+ * so the front is always the best-scoring pair of the window.
+ * next_value is amortized O(1) and never allocates after construction/resize.
+ */
 template<typename T, typename ScoreType, typename Compare=std::less<void>>
 class QueueMap {
     using PairType           = ElScore<T, ScoreType>;
-    using MapType = btree::map<PairType, unsigned>;
-    using map_iterator = typename MapType::iterator;
-    using const_map_iterator = typename MapType::const_iterator;
-    using list_type = circ::deque<ElScore<T, ScoreType>, u32>;
+    struct Entry {
+        PairType v_;
+        u64    idx_; // Index of this pair in the stream, used for expiring it from the window
+    };
 
-    list_type list_;
-    MapType map_;
+    std::vector<Entry> ring_;
+    u64 head_, tail_;   // Deque is ring_[head_ & mask_, tail_ & mask_)
+    u64 nadded_;        // Number of pairs added since the last reset
+    u64 mask_;
     size_t wsz_;  // window size to keep
     public:
-    QueueMap(size_t wsz=1): list_(wsz), wsz_(wsz) {}
-    QueueMap(QueueMap &&o): list_(std::move(o.list_)), map_(std::move(o.map_)), wsz_(o.wsz_) {}
-    QueueMap(const QueueMap &&o): list_(o.list_), map_(o.map_), wsz_(o.wsz_) {}
-    QueueMap &operator=(QueueMap &&o) {
-        list_ = std::move(o.list_);
-        map_ = std::move(o.map_);
-        wsz_ = std::move(o.wsz_);
-        return *this;
-    }
-    QueueMap &operator=(const QueueMap &o) {
-        list_ = o.list_;
-        map_ = o.map_;
-        wsz_ = o.wsz_;
-        return *this;
-    }
+    QueueMap(size_t wsz=1): head_(0), tail_(0), nadded_(0) {resize(wsz);}
+    QueueMap(QueueMap &&o) = default;
+    QueueMap(const QueueMap &o) = default;
+    QueueMap &operator=(QueueMap &&o) = default;
+    QueueMap &operator=(const QueueMap &o) = default;
     void resize(size_t newsz) {
         wsz_ = newsz;
-        list_.resize(newsz);
-    }
-    INLINE void add(const PairType &el) {
-        auto it(map_.lower_bound(el));
-        if(it != map_.end()) {
-            if(it->first == el) ++it->second;
-            else map_.emplace_hint(it, el, 1);
-        } else map_.emplace(el, 1);
+        // One extra slot: a pair is enqueued before the expired front is dropped.
+        ring_.resize(roundup64(u64(newsz) + 1));
+        mask_ = ring_.size() - 1;
+        reset();
     }
-    INLINE void del(const PairType &el) {
-        auto f(map_.find(el));
-        if(--f->second <= 0) map_.erase(f);
-    }
-    map_iterator       begin()       {return map_.begin();}
-    const_map_iterator begin() const {return map_.cbegin();}
-    map_iterator       end()       {return map_.end();}
-    const_map_iterator end() const {return map_.cend();}
     // Do a std::enable_if that involves moving the element if it's by reference?
     T next_value(const T el, const T score) {
-        add(list_.emplace_back(el, score));
-        if(list_.size() > wsz_) del(list_.pop_front());
-        if(list_.size() == wsz_) return map_.begin()->first.el_;
+        const PairType p(el, score);
+        while(tail_ != head_ && !(ring_[(tail_ - 1) & mask_].v_ < p)) --tail_;
+        ring_[tail_++ & mask_] = Entry{p, nadded_++};
+        if(ring_[head_ & mask_].idx_ + wsz_ < nadded_) ++head_;
+        if(nadded_ >= wsz_) return ring_[head_ & mask_].v_.el_;
         if(std::is_same<T, u128>::value)
             return u128(-1);
         return std::numeric_limits<T>::max();
         // Signal a window that is not filled by 0xFFFFFFFFFFFFFFFF
     }
     void reset() {
-        list_.clear(); map_.clear();
+        head_ = tail_ = nadded_ = 0;
     }
     size_t size() const {return wsz_;}
-    size_t n_in_queue() const {return list_.size();}
+    size_t n_in_queue() const {return std::min(nadded_, u64(wsz_));}
     bool partially_full() const {
         const auto n = n_in_queue();
         return n > 0u && n < wsz_;
     }
-    const auto &max_in_queue() const {return begin()->first;}
+    const PairType &max_in_queue() const {
+        assert(head_ != tail_);
+        return ring_[head_ & mask_].v_;
+    }
+    // Index in the stream (counting from 0 at the last reset) of max_in_queue(), and the index the next pair will have.
+    u64 max_index() const {
+        assert(head_ != tail_);
+        return ring_[head_ & mask_].idx_;
+    }
+    u64 n_added() const {return nadded_;}
 };
 
 using qmap_t = QueueMap<u64, u64>;
@@ -0,0 +1,163 @@
+#ifndef BNS_READAHEAD_H__
+#define BNS_READAHEAD_H__
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <thread>
+#if ZWRAP_USE_ZSTD
+#  include "zstd_zlibwrapper.h"
+#else
+#  include <zlib.h>
+#endif
+
+namespace bns {
+
+/*
+ * ReadAhead: double-buffered read-ahead for a gzFile.
+ * While registered, a helper thread calls gzread (so, for gzip input, inflates) into one buffer
+ * while the reading thread parses the other, so decompression overlaps with parsing and hashing.
+ * kseq reads through ReadAhead::read (see kseq_declare.h), which serves registered gzFiles from the buffers
+ * and forwards everything else to gzread, so kseq-based readers need no changes beyond constructing a ReadAhead.
+ *
+ * Full and empty buffers are handed off through an atomic size per buffer; a thread only sleeps
+ * (on a condition variable) if the other has fallen behind.
+ * The gzFile must not be read or closed by anyone else until stop() has been called or the ReadAhead destroyed.
+ */
+class ReadAhead {
+public:
+    static constexpr size_t DEFAULT_BUFSIZE = size_t(1) << 20;
+    static constexpr size_t ALIGNMENT = 4096;
+    static constexpr unsigned MAX_ACTIVE = 256; // Concurrently registered gzFiles; further ones are read directly
+private:
+    static constexpr int64_t EMPTY = -1, FAILED = -2; // Otherwise, the number of bytes in a full buffer, 0 at EOF
+    static constexpr unsigned SPINS = 64;
+    struct Slot {
+        std::atomic<gzFile> fp{nullptr};
+        ReadAhead *ra = nullptr;
+    };
+    static Slot *slots() {static Slot ret[MAX_ACTIVE]; return ret;}
+    static std::atomic<unsigned> &nslots() {static std::atomic<unsigned> ret{0}; return ret;}
+
+    gzFile fp_;
+    size_t bufsize_;
+    char *data_[2]{nullptr, nullptr};
+    std::atomic<int64_t> size_[2]{{EMPTY}, {EMPTY}};
+    unsigned cur_ = 0; // Consumer's buffer
+    size_t off_ = 0;   // Consumer's offset into it
+    int slot_ = -1;
+    std::atomic<bool> stopping_{false};
+    std::atomic<int> sleepers_{0};
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::thread worker_;
+
+    template<typename Pred>
+    void await(const Pred &ready) {
+        for(unsigned i = 0; i < SPINS; ++i) {
+            if(ready()) return;
+            std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> lock(mtx_);
+        ++sleepers_;
+        cv_.wait(lock, ready);
+        --sleepers_;
+    }
+    void wake() {
+        if(sleepers_.load()) {
+            std::lock_guard<std::mutex> lock(mtx_);
+            cv_.notify_all();
+        }
+    }
+    void produce() {
+        for(unsigned i = 0;; i ^= 1) {
+            await([&]() {return size_[i].load() == EMPTY || stopping_.load();});
+            if(stopping_.load()) return;
+            size_t n = 0;
+            int rc = 0;
+            while(n < bufsize_ && (rc = gzread(fp_, data_[i] + n, unsigned(std::min(bufsize_ - n, size_t(INT_MAX))))) > 0)
+                n += rc;
+            const int64_t result = n ? int64_t(n): rc < 0 ? FAILED: 0;
+            size_[i].store(result);
+            wake();
+            if(result <= 0) return;
+        }
+    }
+    int consume(void *buf, unsigned len) {
+        const int64_t n = size_[cur_].load();
+        if(n == EMPTY) {
+            await([&]() {return size_[cur_].load() != EMPTY;});
+            return consume(buf, len);
+        }
+        if(n <= 0) return n == 0 ? 0: -1; // Stays at EOF or error
+        const size_t take = std::min(size_t(len), size_t(n) - off_);
+        std::memcpy(buf, data_[cur_] + off_, take);
+        if((off_ += take) == size_t(n)) {
+            off_ = 0;
+            size_[cur_].store(EMPTY);
+            wake();
+            cur_ ^= 1;
+        }
+        return take;
+    }
+    bool enroll() {
+        Slot *const s = slots();
+        for(unsigned i = 0; i < MAX_ACTIVE; ++i) {
+            gzFile expected = nullptr;
+            if(s[i].fp.load() == nullptr && s[i].fp.compare_exchange_strong(expected, fp_)) {
+                // fp_ is only looked up by its reader, which constructed this, so ra needs no ordering of its own.
+                s[i].ra = this;
+                unsigned n = nslots().load();
+                while(n <= i && !nslots().compare_exchange_weak(n, i + 1));
+                slot_ = i;
+                return true;
+            }
+        }
+        return false;
+    }
+public:
+    // A null fp or enable == false (e.g., for input already decompressed on another thread) makes this a no-op.
+    explicit ReadAhead(gzFile fp, bool enable=true, size_t bufsize=DEFAULT_BUFSIZE):
+        fp_(fp), bufsize_((bufsize + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT)
+    {
+        if(!fp_ || !enable) return;
+        for(auto &p: data_)
+            if((p = static_cast<char *>(std::aligned_alloc(ALIGNMENT, bufsize_))) == nullptr) throw std::bad_alloc();
+        if(!enroll()) return;
+        worker_ = std::thread([this]() {produce();});
+    }
+    ReadAhead(const ReadAhead &) = delete;
+    ReadAhead &operator=(const ReadAhead &) = delete;
+    ~ReadAhead() {
+        stop();
+        for(auto p: data_) std::free(p);
+    }
+    // Stops reading ahead; data already read ahead but not consumed is discarded. Call before closing the gzFile.
+    void stop() {
+        if(slot_ < 0) return;
+        stopping_.store(true);
+        wake();
+        worker_.join();
+        slots()[slot_].ra = nullptr;
+        slots()[slot_].fp.store(nullptr);
+        slot_ = -1;
+    }
+    bool active() const {return slot_ >= 0;}
+
+    // gzread, from read-ahead buffers if fp is registered.
+    static int read(gzFile fp, void *buf, unsigned len) {
+        const Slot *const s = slots();
+        for(unsigned i = 0, n = nslots().load(std::memory_order_relaxed); i < n; ++i)
+            if(s[i].fp.load(std::memory_order_relaxed) == fp)
+                return s[i].ra->consume(buf, len);
+        return gzread(fp, buf, len);
+    }
+};
+
+} // namespace bns
+
+#endif /* BNS_READAHEAD_H__ */
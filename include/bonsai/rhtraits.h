@@ -56,11 +56,14 @@ static inline KmerT rhmask(InputType it, int k) {
         case DNA2: case DNAC:
             ret = static_cast<KmerT>(-1) >> (sizeof(KmerT) * 8 - k); break;
         case PROTEIN_3BIT:
-            ret = static_cast<KmerT>(-1) >> (sizeof(KmerT) * 8 - k); break;
+            if(size_t(k) * 3 < sizeof(KmerT) * 8) ret = static_cast<KmerT>(-1) >> (sizeof(KmerT) * 8 - k * 3);
+            break;
         case PROTEIN20: ret =  std::pow(20, k); break;
         case PROTEIN6: ret =  std::pow(6, k); break;
         case PROTEIN14: ret =  std::pow(14, k); break;
-        case PROTEIN: ret = (static_cast<KmerT>(-1) >> (sizeof(KmerT) * 8 - (k << 8))); break;
+        case PROTEIN:
+            if(size_t(k) * 8 < sizeof(KmerT) * 8) ret = static_cast<KmerT>(-1) >> (sizeof(KmerT) * 8 - k * 8);
+            break;
         default:;
     }
     // else, stays at -1
@@ -136,7 +139,8 @@ static constexpr const int8_t *rh2lp(InputType rht) {
     switch(rht) {
 #define CASE(x) case x: return RHTraits<x>::table.data();
         ALL_CASES
-        case PROTEIN_6_FRAME: default: ;
+        case PROTEIN_6_FRAME: return alph::DNA4.data(); // Input is nucleotides, translated via translate.h
+        default: ;
 #undef CASE
     }
     return RHTraits<PROTEIN>::table.data();
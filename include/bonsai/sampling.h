@@ -0,0 +1,86 @@
+#ifndef BNS_SAMPLING_H__
+#define BNS_SAMPLING_H__
+#include <fstream>
+#include <string>
+#include "bonsai/util.h"
+#include "bonsai/kmerutil.h"
+
+namespace bns {
+
+/*
+ * k-mer sampling schemes other than windowed minimizers.
+ * Minimizer:     the best-scoring k-mer of each window (QueueMap over ScoreType), density about 2/(w+1).
+ * OpenSyncmer:   k-mers whose smallest s-mer starts at offset t.
+ * ClosedSyncmer: k-mers whose smallest s-mer is their first or last.
+ * ModMinimizer:  for each window of w k-mers, the smallest t-mer at offset x selects the k-mer at x mod w
+ *                (Groot Koerkamp and Pibiri, 2024), approaching density 1/w for large k.
+ * s-mers and t-mers are compared by lex_score of their (canonical, if canonicalizing) encoding.
+ * Both syncmer kinds are context-free, and closed syncmers guarantee one sample per window of k - s + 1 k-mers;
+ * mod-minimizers keep the window guarantee of minimizers.
+ */
+enum class Sampling {
+    Minimizer,
+    OpenSyncmer,
+    ClosedSyncmer,
+    ModMinimizer
+};
+
+static inline const char *to_string(Sampling s) {
+    switch(s) {
+        case Sampling::Minimizer:     return "minimizer";
+        case Sampling::OpenSyncmer:   return "open-syncmer";
+        case Sampling::ClosedSyncmer: return "closed-syncmer";
+        case Sampling::ModMinimizer:  return "mod-minimizer";
+    }
+    return "unknown";
+}
+
+/*
+ * KmerOrderSet: a precomputed set of DNA k-mers (k <= 32) which minimizer windows prefer,
+ * such as a universal hitting set or a minimum decycling set.
+ * Pass it as the data pointer of an Encoder<score::Set>.
+ * Files hold whitespace-separated k-mers; lines starting with '#' or '>' are skipped.
+ */
+class KmerOrderSet {
+    khash_t(all) *set_;
+    unsigned k_;
+    bool canon_;
+public:
+    KmerOrderSet(unsigned k, bool canon=true): set_(kh_init(all)), k_(k), canon_(canon) {
+        if(k_ > 32 || k_ == 0) UNRECOVERABLE_ERROR(std::string("KmerOrderSet supports 0 < k <= 32, not ") + std::to_string(k));
+    }
+    KmerOrderSet(const char *path, unsigned k, bool canon=true): KmerOrderSet(k, canon) {
+        std::ifstream ifs(path);
+        if(!ifs) UNRECOVERABLE_ERROR(std::string("Could not open k-mer set at ") + path);
+        for(std::string line; std::getline(ifs, line);) {
+            if(line.empty() || line[0] == '#' || line[0] == '>') continue;
+            std::istringstream iss(line);
+            for(std::string km; iss >> km;) add(km.data(), km.size());
+        }
+    }
+    KmerOrderSet(const KmerOrderSet &) = delete;
+    KmerOrderSet &operator=(const KmerOrderSet &) = delete;
+    ~KmerOrderSet() {kh_destroy(all, set_);}
+    void add(u64 kmer) {
+        int khr;
+        kh_put(all, set_, canon_ ? canonical_representation(kmer, k_): kmer, &khr);
+    }
+    void add(const char *s, size_t l) {
+        if(l != k_) UNRECOVERABLE_ERROR(std::string("Expected a k-mer of length ") + std::to_string(k_) + ", got " + std::string(s, l));
+        u64 kmer = 0;
+        for(size_t i = 0; i < l; ++i) {
+            const int8_t v = cstr_lut[static_cast<uint8_t>(s[i])];
+            if(v < 0) UNRECOVERABLE_ERROR(std::string("Invalid character in k-mer ") + std::string(s, l));
+            kmer = (kmer << 2) | v;
+        }
+        add(kmer);
+    }
+    // Expects k-mers as the Encoder emits them (so already canonical if canonicalizing).
+    bool contains(u64 kmer) const {return kh_get(all, set_, kmer) != kh_end(set_);}
+    size_t size() const {return kh_size(set_);}
+    unsigned k() const {return k_;}
+};
+
+} // namespace bns
+
+#endif /* BNS_SAMPLING_H__ */
@@ -5,6 +5,9 @@
 #include <string>
 #include <algorithm>
 #include "kmerutil.h"
+#if __BMI2__
+#  include <immintrin.h>
+#endif
 
 namespace bns {
 using std::uint16_t;
@@ -173,6 +176,73 @@ public:
     spvec_t sub1() const {spvec_t ret(s_);std::transform(ret.begin(), ret.end(), ret.begin(), [](auto x) {return x - 1;}); return ret;}
 };
 
+/*
+ * SpacedGather: extracts a spaced seed from a packed window holding the last c characters,
+ * with the most recent character in the lowest nbits bits.
+ * Each contiguous run of selected positions is moved with one shift and one mask.
+ * With BMI2, the seed is instead extracted by PEXT over the window.
+ * Valid when c <= 64 and c * nbits <= 128.
+ */
+struct SpacedGather {
+    struct Run {
+        u32 in_shift_, out_shift_;
+        u128 mask_;
+    };
+    spvec_t s_;
+    u32 nbits_, k_, c_;
+    std::vector<Run> runs_;
+    u128 selmask_;  // Window bits belonging to the seed
+    u64 charmask_;  // Bit i set iff the character i positions before the most recent is part of the seed
+    u128 winmask_;  // All c * nbits window bits
+
+    SpacedGather(): nbits_(0), k_(0), c_(0), selmask_(0), charmask_(0), winmask_(0) {}
+    SpacedGather(const Spacer &sp, u32 nbits): s_(sp.s_), nbits_(nbits), k_(sp.k_), c_(sp.c_), selmask_(0), charmask_(0) {
+        if(!usable(sp, nbits)) return;
+        winmask_ = c_ * nbits_ == 128 ? u128(-1): (u128(1) << (c_ * nbits_)) - 1;
+        u32 p = 0; // Position of the j-th selected character within the comb
+        for(u32 j = 0; j < k_;) {
+            // Extend run while positions are contiguous
+            u32 jend = j;
+            while(jend + 1 < k_ && s_[jend] == 1) ++jend;
+            const u32 plast = p + (jend - j), nsel = jend - j + 1;
+            Run r;
+            r.in_shift_ = (c_ - 1 - plast) * nbits_;
+            r.out_shift_ = (k_ - 1 - jend) * nbits_;
+            r.mask_ = nsel * nbits_ == 128 ? u128(-1): (u128(1) << (nsel * nbits_)) - 1;
+            runs_.push_back(r);
+            selmask_ |= r.mask_ << r.in_shift_;
+            for(u32 i = p; i <= plast; ++i) charmask_ |= u64(1) << (c_ - 1 - i);
+            if(jend + 1 < k_) p = plast + s_[jend];
+            j = jend + 1;
+        }
+    }
+    static bool usable(const Spacer &sp, u32 nbits) {
+        return nbits > 0 && sp.c_ <= 64 && sp.c_ * nbits <= 128;
+    }
+    bool usable() const {return nbits_ > 0 && c_ <= 64 && c_ * nbits_ <= 128;}
+    bool matches(const Spacer &sp, u32 nbits) const {
+        return nbits == nbits_ && sp.k_ == k_ && sp.c_ == c_ && sp.s_ == s_;
+    }
+    template<typename KmerT, typename WindowT>
+    INLINE KmerT extract(WindowT window) const {
+#if __BMI2__
+        if constexpr(sizeof(WindowT) <= 8) {
+            return _pext_u64(window, static_cast<u64>(selmask_));
+        } else {
+            const u64 lomask = static_cast<u64>(selmask_), himask = static_cast<u64>(selmask_ >> 64);
+            const KmerT lo = _pext_u64(static_cast<u64>(window), lomask);
+            if(!himask) return lo;
+            return (KmerT(_pext_u64(static_cast<u64>(window >> 64), himask)) << __builtin_popcountll(lomask)) | lo;
+        }
+#else
+        KmerT ret = 0;
+        for(const auto &r: runs_)
+            ret |= KmerT((window >> r.in_shift_) & static_cast<WindowT>(r.mask_)) << r.out_shift_;
+        return ret;
+#endif
+    }
+};
+
 } // namespace bns
 
 #endif // #ifndef _EMP_SPACE_H__
@@ -0,0 +1,77 @@
+#ifndef BNS_TRANSLATE_H__
+#define BNS_TRANSLATE_H__
+#include <array>
+#include <cstdint>
+#include <string>
+#include "alphabet.h"
+
+namespace bns {
+
+/*
+ * Codon translation for six-frame (PROTEIN_6_FRAME) encoding.
+ * Codons are indexed by 16 * b0 + 4 * b1 + b2 for DNA4 codes (A: 0, C: 1, G: 2, T: 3),
+ * which is what shifting nucleotides into a 6-bit register yields.
+ * Stop codons translate to '*'.
+ */
+static constexpr const char STANDARD_GENETIC_CODE[65] =
+    "KNKNTTTTRSRSIIMIQHQHPPPPRRRRLLLLEDEDAAAAGGGGVVVV*Y*YSSSS*CWCLFLF";
+
+static constexpr inline unsigned reverse_complement_codon(unsigned c) {
+    return ((3 - (c & 3)) << 4) | ((3 - ((c >> 2) & 3)) << 2) | (3 - (c >> 4));
+}
+
+// Residue codes under a protein alphabet's LUT for each codon on either strand (-1 if the residue is invalid there).
+// rev[c] is the code for the reverse-strand codon spanning the same three bases as forward codon c.
+struct CodonTable {
+    std::array<int8_t, 64> fwd, rev;
+    CodonTable(const int8_t *lut) {
+        for(unsigned c = 0; c < 64; ++c) {
+            fwd[c] = lut[static_cast<uint8_t>(STANDARD_GENETIC_CODE[c])];
+            rev[c] = lut[static_cast<uint8_t>(STANDARD_GENETIC_CODE[reverse_complement_codon(c)])];
+        }
+    }
+};
+
+/*
+ * Translates frame `frame` of s[0, l).
+ * Frames 0-2 read the forward strand starting at offset frame,
+ * frames 3-5 read the reverse complement starting at offset frame - 3 from the end of s.
+ * Codons with an ambiguous base translate to 'X'.
+ */
+static inline std::string translate_frame(const char *s, size_t l, unsigned frame) {
+    const int8_t *lut = alph::DNA4.data();
+    std::string ret;
+    const size_t off = frame % 3;
+    for(size_t i = off; i + 3 <= l; i += 3) {
+        unsigned c = 0;
+        bool bad = false;
+        for(size_t j = 0; j < 3; ++j) {
+            const int8_t v = frame < 3 ? lut[static_cast<uint8_t>(s[i + j])]: lut[static_cast<uint8_t>(s[l - 1 - i - j])];
+            if(v < 0) {bad = true; break;}
+            c = (c << 2) | (frame < 3 ? v: 3 - v);
+        }
+        ret.push_back(bad ? 'X': STANDARD_GENETIC_CODE[c]);
+    }
+    return ret;
+}
+
+/*
+ * Exact division by a fixed d of values known to be multiples of d:
+ * shifts out the power of two and multiplies by the inverse of the odd part modulo 2^bits.
+ */
+template<typename T>
+struct ExactDivider {
+    T inv_;
+    unsigned shift_;
+    ExactDivider(T d): shift_(0) {
+        while(!(d & 1)) d >>= 1, ++shift_;
+        T x = d; // Correct to 3 bits; each Newton step doubles that.
+        for(unsigned i = 0; i < 6; ++i) x *= T(2) - d * x;
+        inv_ = x;
+    }
+    T operator()(T x) const {return (x >> shift_) * inv_;}
+};
+
+} // namespace bns
+
+#endif /* BNS_TRANSLATE_H__ */
@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <numeric>
 #include <glob.h>
+#include <sys/stat.h>
 
 using namespace bns;
 using EncType = Encoder<score::Lex>;
@@ -336,3 +337,1213 @@ TEST_CASE("xzparse") {
     }
     globfree(&glo);
 }
+TEST_CASE("packed_dna_matches_scalar") {
+    std::mt19937_64 mt(13);
+    static const char alph[] = "ACGTACGTACGTacgtacgtNNRU-";
+    for(const size_t len: {size_t(7), size_t(63), size_t(64), size_t(65), size_t(1000), size_t(10000)}) {
+        std::string s(len, 'A');
+        for(auto &c: s) c = alph[mt() % (sizeof(alph) - 1)];
+        if(len > 500) std::fill(&s[100], &s[300], 'N');
+        for(const unsigned k: {1u, 15u, 31u, 32u}) {
+            Encoder<> enc(k, false);
+            std::vector<u64> ref, packed;
+            enc.assign(s.data(), s.size());
+            enc.for_each_uncanon_unspaced_unwindowed_scalar([&](u64 x) {ref.push_back(x);});
+            enc.assign(s.data(), s.size());
+            enc.for_each_uncanon_unspaced_unwindowed([&](u64 x) {packed.push_back(x);});
+            REQUIRE(ref == packed);
+        }
+        Encoder<score::Lex, u128> enc(Spacer(50), false);
+        std::vector<u128> ref, packed;
+        enc.assign(s.data(), s.size());
+        enc.for_each_uncanon_unspaced_unwindowed_scalar([&](u128 x) {ref.push_back(x);});
+        enc.assign(s.data(), s.size());
+        enc.for_each_uncanon_unspaced_unwindowed([&](u128 x) {packed.push_back(x);});
+        REQUIRE(ref == packed);
+    }
+    gzFile fp = gzopen("test/phix.fa", "rb");
+    kseq_t *ks = kseq_init(fp);
+    while(kseq_read(ks) >= 0) {
+        Encoder<> enc(31, false);
+        std::vector<u64> ref, packed;
+        enc.assign(ks);
+        enc.for_each_uncanon_unspaced_unwindowed_scalar([&](u64 x) {ref.push_back(x);});
+        enc.assign(ks);
+        enc.for_each_uncanon_unspaced_unwindowed([&](u64 x) {packed.push_back(x);});
+        REQUIRE(ref.size() > 0);
+        REQUIRE(ref == packed);
+    }
+    kseq_destroy(ks);
+    gzclose(fp);
+}
+TEST_CASE("qmap_matches_naive_window_min") {
+    std::mt19937_64 mt(1337);
+    for(const size_t wsz: {size_t(1), size_t(2), size_t(7), size_t(20), size_t(64)}) {
+        QueueMap<u64, u64> qmap(wsz);
+        for(int rep = 0; rep < 2; ++rep) {
+            qmap.reset();
+            std::vector<elscore_t> seen;
+            for(size_t i = 0; i < 2000; ++i) {
+                const u64 el = mt() % 32, score = mt() % 8; // Many ties
+                seen.emplace_back(el, score);
+                const u64 ret = qmap.next_value(el, score);
+                if(seen.size() < wsz) {
+                    REQUIRE(ret == u64(-1));
+                    REQUIRE(qmap.partially_full());
+                    REQUIRE(qmap.max_in_queue().el_ == std::min_element(seen.begin(), seen.end())->el_);
+                } else {
+                    REQUIRE(ret == std::min_element(seen.end() - wsz, seen.end())->el_);
+                    REQUIRE(!qmap.partially_full());
+                }
+            }
+        }
+    }
+}
+TEST_CASE("canonical_rc_register") {
+    std::mt19937_64 mt(7);
+    static const char alph[] = "ACGTACGTACGTacgtNR";
+    std::string s(5000, 'A');
+    for(auto &c: s) c = alph[mt() % (sizeof(alph) - 1)];
+    auto rc128 = [](u128 x, unsigned k) {
+        u128 ret = 0;
+        for(unsigned i = 0; i < k; ++i, x >>= 2) ret = (ret << 2) | (3 - (x & 3));
+        return ret;
+    };
+    for(const unsigned k: {5u, 21u, 31u, 32u}) {
+        Encoder<> enc(k, true);
+        std::vector<u64> ref, canon;
+        enc.assign(s.data(), s.size());
+        enc.for_each_uncanon_unspaced_unwindowed_scalar([&](u64 x) {ref.push_back(canonical_representation(x, k));});
+        enc.assign(s.data(), s.size());
+        enc.for_each_canon_unwindowed([&](u64 x) {canon.push_back(x);});
+        REQUIRE(ref == canon);
+        for(const unsigned w: {k + 1, k + 20}) {
+            Encoder<> wenc(Spacer(k, w), true);
+            std::vector<u64> wref, wcanon;
+            wenc.assign(s.data(), s.size());
+            u64 km;
+            while(wenc.has_next_kmer())
+                if((km = wenc.next_canonicalized_minimizer()) != BF)
+                    wref.push_back(km);
+            wenc.assign(s.data(), s.size());
+            wenc.for_each_canon_windowed([&](u64 x) {wcanon.push_back(x);});
+            REQUIRE(wref.size() > 0);
+            REQUIRE(wref == wcanon);
+        }
+    }
+    Encoder<score::Lex, u128> enc(Spacer(50), true);
+    std::vector<u128> ref, canon;
+    enc.assign(s.data(), s.size());
+    enc.for_each_uncanon_unspaced_unwindowed_scalar([&](u128 x) {ref.push_back(std::min(x, rc128(x, 50)));});
+    enc.assign(s.data(), s.size());
+    enc.for_each_canon_unwindowed([&](u128 x) {canon.push_back(x);});
+    REQUIRE(ref == canon);
+}
+
+TEST_CASE("rolling_spaced_matches_kmer") {
+    std::mt19937_64 mt(11);
+    static const char alph[] = "ACGTACGTACGTacgtNR";
+    std::string s(4000, 'A');
+    for(auto &c: s) c = alph[mt() % (sizeof(alph) - 1)];
+    auto check = [&](auto &enc) {
+        using K = std::decay_t<decltype(enc.kmer(0))>;
+        std::vector<K> ref, rolled;
+        enc.assign(s.data(), s.size());
+        K km;
+        while(enc.has_next_kmer())
+            if((km = enc.next_minimizer()) != static_cast<K>(-1))
+                ref.push_back(km);
+        enc.for_each([&](K x) {rolled.push_back(x);}, s.data(), s.size());
+        REQUIRE(ref.size() > 0);
+        REQUIRE(ref == rolled);
+    };
+    for(const unsigned k: {11u, 21u}) {
+        for(const unsigned maxgap: {1u, 4u}) {
+            spvec_t sv(k - 1);
+            for(auto &x: sv) x = mt() % (maxgap + 1);
+            const unsigned c = comb_size(sv);
+            for(const unsigned wextra: {0u, 17u}) {
+                Encoder<> enc(Spacer(k, c + wextra, sv), false);
+                check(enc);
+                Encoder<score::Lex, u128> enc128(Spacer(k, c + wextra, sv), false);
+                check(enc128);
+            }
+        }
+    }
+    Encoder<> enc3(Spacer(13, 40, parse_spacing("1x12", 13)), false);
+    enc3.hashtype(PROTEIN_3BIT);
+    check(enc3);
+}
+
+TEST_CASE("multi_seed_matches_encoder") {
+    std::mt19937_64 mt(13);
+    static const char alph[] = "ACGTACGTACGTacgtNR";
+    std::string s(4000, 'A');
+    for(auto &c: s) c = alph[mt() % (sizeof(alph) - 1)];
+    std::vector<Spacer> sps;
+    sps.emplace_back(15);
+    sps.emplace_back(31);
+    sps.emplace_back(15, 40);
+    sps.emplace_back(21, 50);
+    for(const unsigned k: {11u, 21u}) {
+        spvec_t sv(k - 1);
+        for(auto &x: sv) x = mt() % 3;
+        sps.emplace_back(k, comb_size(sv), sv);
+        sps.emplace_back(k, comb_size(sv) + 13, sv);
+    }
+    auto check = [&](auto &menc, auto kmer_tag, const std::vector<Spacer> &sps) {
+        using K = decltype(kmer_tag);
+        std::vector<std::vector<K>> got(sps.size());
+        menc.for_each([&](K km, size_t i) {got[i].push_back(km);}, s.data(), s.size());
+        for(size_t i = 0; i < sps.size(); ++i) {
+            Encoder<score::Lex, K> enc(sps[i], menc.canonicalize());
+            enc.hashtype(menc.hashtype());
+            std::vector<K> ref;
+            enc.for_each([&](K km) {ref.push_back(km);}, s.data(), s.size());
+            REQUIRE(ref.size() > 0);
+            REQUIRE(ref == got[i]);
+        }
+    };
+    for(const bool canon: {false, true}) {
+        MultiSeedEncoder<> menc(sps, canon);
+        REQUIRE(menc.single_pass());
+        check(menc, u64(0), sps);
+        MultiSeedEncoder<score::Lex, u128> menc128(sps, canon);
+        check(menc128, u128(0), sps);
+    }
+    const std::vector<Spacer> psps{Spacer(7), Spacer(9, 20), Spacer(5, 9, parse_spacing("1x4", 5))};
+    MultiSeedEncoder<> pmenc(psps, false);
+    pmenc.hashtype(PROTEIN20);
+    REQUIRE(!pmenc.single_pass());
+    check(pmenc, u64(0), psps);
+}
+
+TEST_CASE("for_each_batch_matches_for_each") {
+    std::mt19937_64 mt(17);
+    static const char alph[] = "ACGTACGTACGTacgtN";
+    std::string s(3000, 'A');
+    for(auto &c: s) c = alph[mt() % (sizeof(alph) - 1)];
+    Encoder<> enc(21, true);
+    std::vector<u64> ref, batched, smallbatched;
+    enc.for_each([&](u64 x) {ref.push_back(x);}, s.data(), s.size());
+    enc.for_each_batch([&](KmerSpan<u64> sp) {
+        REQUIRE(sp.size() <= DEFAULT_BATCH_SIZE);
+        batched.insert(batched.end(), sp.begin(), sp.end());
+    }, s.data(), s.size());
+    REQUIRE(ref == batched);
+    std::vector<u64> buf(7);
+    enc.for_each_batch([&](KmerSpan<u64> sp) {
+        REQUIRE(sp.size() <= 7);
+        smallbatched.insert(smallbatched.end(), sp.begin(), sp.end());
+    }, buf, s.data(), s.size());
+    REQUIRE(ref == smallbatched);
+
+    RollingHasher<uint64_t> rh(25, true);
+    std::vector<u64> rhref, rhbatched;
+    rh.for_each_hash([&](u64 x) {rhref.push_back(x);}, s.data(), s.size());
+    rh.for_each_batch([&](KmerSpan<u64> sp) {rhbatched.insert(rhbatched.end(), sp.begin(), sp.end());}, s.data(), s.size());
+    REQUIRE(rhref.size() > 0);
+    REQUIRE(rhref == rhbatched);
+
+    RollingHasherSet<uint64_t> rhs(std::vector<int>{15, 21, 31}, false);
+    std::vector<std::vector<u64>> rhsref(3), rhsbatched(3);
+    rhs.for_each_hash([&](u64 x, size_t i) {rhsref[i].push_back(x);}, s.data(), s.size());
+    rhs.for_each_batch([&](KmerSpan<u64> sp, size_t i) {rhsbatched[i].insert(rhsbatched[i].end(), sp.begin(), sp.end());}, s.data(), s.size());
+    REQUIRE(rhsref == rhsbatched);
+}
+
+TEST_CASE("rolling_hasher_set_matches_rolling_hasher") {
+    // Runs of N in the first k bases, mid-record, and within 2 * min(k) of the end
+    std::mt19937_64 mt(10);
+    std::string s(400, 'A');
+    for(auto &c: s) c = "ACGT"[mt() & 3];
+    for(const size_t pos: {size_t(5), size_t(40), size_t(41), size_t(150), size_t(360), size_t(385)}) {
+        const size_t n = 1 + mt() % 4;
+        s.replace(pos, n, n, 'N');
+    }
+    for(const bool canon: {false, true}) {
+        RollingHasherSet<uint64_t> rhs(std::vector<int>{15, 21, 31}, canon);
+        std::vector<std::vector<u64>> got(3);
+        rhs.for_each_hash([&](u64 x, size_t i) {got[i].push_back(x);}, s.data(), s.size());
+        for(size_t i = 0; i < 3; ++i) {
+            RollingHasher<uint64_t> rh(rhs.hashers_[i]);
+            std::vector<u64> ref;
+            rh.for_each_hash([&](u64 x) {ref.push_back(x);}, s.data(), s.size());
+            REQUIRE(ref.size() > 0);
+            REQUIRE(got[i] == ref);
+        }
+    }
+}
+
+TEST_CASE("exact_u128_kmers") {
+    std::mt19937_64 mt(19);
+    for(const unsigned k: {33u, 41u, 63u, 64u}) {
+        for(size_t i = 0; i < 1000; ++i) {
+            u128 x = (u128(mt()) << 64) | mt();
+            if(k < 64) x &= (u128(1) << (2 * k)) - 1;
+            u128 slow = 0, tmp = x;
+            for(unsigned j = 0; j < k; ++j, tmp >>= 2) slow = (slow << 2) | (3 - (tmp & 3));
+            REQUIRE(reverse_complement(x, k) == slow);
+            REQUIRE(canonical_representation(x, k) == std::min(x, slow));
+            const Kmer128 key(x);
+            REQUIRE(u128(key) == x);
+            REQUIRE(Kmer128Hash()(key) == fold128(x));
+        }
+    }
+    REQUIRE(to_string(u128(12345)) == "12345");
+    REQUIRE(to_string(u128(-1)) == "340282366920938463463374607431768211455");
+}
+
+TEST_CASE("circus_ent_matches_naive") {
+    std::mt19937_64 mt(23);
+    for(const size_t qsz: {1u, 7u, 21u, 31u}) {
+        CircusEnt ent(qsz);
+        std::vector<char> syms;
+        for(size_t i = 0; i < 2000; ++i) {
+            if(i == 1000) ent.clear(), syms.clear();
+            const char c = mt() % (i < 500 ? 4: 20);
+            syms.push_back(c);
+            const double v = ent.next_ent(c);
+            if(syms.size() < qsz) {
+                REQUIRE(v == CircusEnt::NOT_FULL);
+                continue;
+            }
+            std::map<char, size_t> counts;
+            for(size_t j = syms.size() - qsz; j < syms.size(); ++j) ++counts[syms[j]];
+            double naive = 0.;
+            for(const auto &p: counts) naive += p.second / double(qsz) * std::log(p.second / double(qsz));
+            REQUIRE(std::abs(v - naive) < 1e-8);
+        }
+    }
+}
+
+TEST_CASE("parallel_chunks_match_serial") {
+    std::mt19937_64 mt(29);
+    static const char alph[] = "ACGTACGTACGTACGTACGTacgtN";
+    std::string s(20000, 'A');
+    for(auto &c: s) c = alph[mt() % (sizeof(alph) - 1)];
+    spvec_t sv(14);
+    for(auto &x: sv) x = mt() % 3;
+    auto check = [&](auto &enc) {
+        using K = std::decay_t<decltype(enc.kmer(0))>;
+        REQUIRE(enc.parallelizable());
+        std::vector<K> ref, par;
+        enc.for_each([&](K x) {ref.push_back(x);}, s.data(), s.size());
+        for(const u64 chunksize: {97u, 1000u}) {
+            par.clear();
+            enc.for_each_parallel([&](K x) {par.push_back(x);}, s.data(), s.size(), 4, chunksize);
+            REQUIRE(ref == par);
+            std::vector<std::vector<K>> unordered(4);
+            enc.for_each_parallel_unordered([&](K x, unsigned tid) {unordered[tid].push_back(x);}, s.data(), s.size(), 4, chunksize);
+            std::vector<K> flat;
+            for(const auto &v: unordered) flat.insert(flat.end(), v.begin(), v.end());
+            std::vector<K> sref(ref);
+            std::sort(sref.begin(), sref.end()), std::sort(flat.begin(), flat.end());
+            REQUIRE(sref == flat);
+        }
+    };
+    for(const bool canon: {true, false}) {
+        Encoder<> enc(Spacer(21), canon);
+        check(enc);
+    }
+    Encoder<> wenc(Spacer(21, 40), true);
+    check(wenc);
+    Encoder<score::Lex, u128> wenc128(Spacer(41, 60), true);
+    check(wenc128);
+    Encoder<> senc(Spacer(15, comb_size(sv) + 11, sv), false);
+    check(senc);
+    Encoder<> uwenc(Spacer(21, 40), false);
+    REQUIRE(!uwenc.parallelizable());
+}
+
+TEST_CASE("n_runs_skipped") {
+    std::mt19937_64 mt(31);
+    static const char acgt[] = "ACGTacgt";
+    std::string s;
+    while(s.size() < 50000) {
+        for(size_t i = 0, n = mt() % 80; i < n; ++i) s.push_back(acgt[mt() % 8]);
+        if(mt() % 8 == 0) s.push_back('R');
+        for(size_t i = 0, n = 1 + mt() % 300; i < n; ++i) s.push_back(mt() & 1 ? 'N': 'n');
+    }
+    for(size_t i = 0; i < s.size(); i += 1 + mt() % 97) {
+        size_t naive = i;
+        while(naive < s.size() && (s[naive] == 'N' || s[naive] == 'n')) ++naive;
+        REQUIRE(skip_n_run(s.data(), i, s.size()) == naive);
+    }
+    const unsigned k = 21;
+    std::vector<size_t> starts;
+    for(size_t i = 0; i + k <= s.size(); ++i)
+        if(std::all_of(&s[i], &s[i + k], [](char c) {return cstr_lut[static_cast<uint8_t>(c)] >= 0;}))
+            starts.push_back(i);
+    for(const bool canon: {true, false}) {
+        Encoder<> enc(Spacer(k), canon);
+        std::vector<u64> ref, got;
+        for(const auto i: starts) {
+            u64 km = 0;
+            for(size_t j = 0; j < k; ++j) km = (km << 2) | cstr_lut[static_cast<uint8_t>(s[i + j])];
+            ref.push_back(canon ? canonical_representation(km, k): km);
+        }
+        enc.for_each([&](u64 x) {got.push_back(x);}, s.data(), s.size());
+        REQUIRE(ref == got);
+        RollingHasher<uint64_t> rh(k, canon);
+        ref.clear(), got.clear();
+        for(const auto i: starts) rh.for_each_hash([&](u64 x) {ref.push_back(x);}, &s[i], k);
+        rh.for_each_hash([&](u64 x) {got.push_back(x);}, s.data(), s.size());
+        // Every k-mer following an N run is now hashed, rather than skipping k bases past it.
+        REQUIRE(ref == got);
+    }
+}
+
+TEST_CASE("mixed_radix_protein_rolling") {
+    std::mt19937_64 mt(41);
+    static const char aa[] = "ACDEFGHIKLMNPQRSTVWYacdefghiklmnpqrstvwy";
+    std::string s(20000, 'A');
+    for(auto &c: s) c = mt() % 200 ? aa[mt() % (sizeof(aa) - 1)]: 'X';
+    for(const auto rht: {PROTEIN20, PROTEIN_14, PROTEIN_6}) {
+        const unsigned k = 9;
+        const size_t mul = bns::mul(rht);
+        const int8_t *lut = rh2lp(rht);
+        std::vector<u64> ref, got;
+        std::vector<u64> all(s.size() - k + 1, u64(-1)); // naive base-mul value per start, or -1
+        for(size_t i = 0; i + k <= s.size(); ++i) {
+            u64 km = 0;
+            for(size_t j = 0; j < k; ++j) {
+                const int8_t v = lut[static_cast<uint8_t>(s[i + j])];
+                if(v < 0) {km = u64(-1); break;}
+                km = km * mul + v;
+            }
+            if((all[i] = km) != u64(-1)) ref.push_back(km);
+        }
+        Encoder<> enc(Spacer(k), false);
+        enc.hashtype(rht);
+        enc.for_each([&](u64 x) {got.push_back(x);}, s.data(), s.size());
+        REQUIRE(ref == got);
+        enc.assign(s.data(), s.size());
+        for(size_t i = 0; i + k <= s.size(); i += 37) REQUIRE(enc.kmer(i) == all[i]);
+        // Windowed: the minimum by value over each window of w consecutive starts, as in the qmap.
+        const unsigned w = 8;
+        Encoder<> wenc(Spacer(k, k + w - 1), false);
+        wenc.hashtype(rht);
+        std::vector<u64> wgot;
+        wenc.for_each([&](u64 x) {wgot.push_back(x);}, s.data(), s.size());
+        REQUIRE(!wgot.empty());
+        for(const auto x: wgot) REQUIRE(std::find(ref.begin(), ref.end(), x) != ref.end());
+    }
+}
+
+TEST_CASE("six_frame_matches_translated") {
+    std::mt19937_64 mt(43);
+    std::string s(3000, 'A');
+    for(auto &c: s) c = mt() % 300 ? "ACGTacgt"[mt() % 8]: 'N';
+    auto check = [&](auto &enc, InputType target) {
+        using K = std::decay_t<decltype(enc.kmer(0))>;
+        std::vector<K> got[6];
+        enc.for_each_frame([&](K x, unsigned f) {got[f].push_back(x);}, s.data(), s.size());
+        for(unsigned f = 0; f < 6; ++f) {
+            const std::string t = translate_frame(s.data(), s.size(), f);
+            std::decay_t<decltype(enc)> penc(Spacer(enc.k()), false);
+            penc.hashtype(target);
+            std::vector<K> ref;
+            penc.for_each([&](K x) {ref.push_back(x);}, t.data(), t.size());
+            if(f >= 3) std::reverse(got[f].begin(), got[f].end()); // Reverse frames are emitted right to left
+            REQUIRE(!ref.empty());
+            REQUIRE(ref == got[f]);
+        }
+    };
+    for(const auto target: {PROTEIN20, PROTEIN_14, PROTEIN_6, PROTEIN_3BIT}) {
+        Encoder<> enc(Spacer(5), false);
+        enc.hashtype(PROTEIN_6_FRAME);
+        enc.translated_alphabet(target);
+        check(enc, target);
+    }
+    Encoder<score::Lex, u128> enc128(Spacer(20), false);
+    enc128.hashtype(PROTEIN_6_FRAME);
+    check(enc128, PROTEIN20);
+}
+
+TEST_CASE("syncmers_and_mod_minimizers") {
+    std::mt19937_64 mt(47);
+    std::string s(20000, 'A');
+    for(auto &c: s) c = mt() % 500 ? "ACGTacgt"[mt() % 8]: 'N';
+    const unsigned k = 21;
+    auto encode = [&](size_t p, unsigned len) {
+        u64 x = 0;
+        for(size_t j = 0; j < len; ++j) {
+            const int8_t v = cstr_lut[static_cast<uint8_t>(s[p + j])];
+            if(v < 0) return u64(-1);
+            x = (x << 2) | v;
+        }
+        return x;
+    };
+    // Start of the best m-mer in s[p, p + len), leftmost on ties.
+    auto best_mmer = [&](size_t p, unsigned len, unsigned m, bool canon) {
+        size_t best = p;
+        u64 bs = u64(-1);
+        for(size_t q = p; q + m <= p + len; ++q) {
+            const u64 x = encode(q, m), sc = lex_score(canon ? canonical_representation(x, m): x);
+            if(sc < bs) bs = sc, best = q;
+        }
+        return best;
+    };
+    for(const bool canon: {true, false}) {
+        for(const auto mode: {Sampling::ClosedSyncmer, Sampling::OpenSyncmer}) {
+            const unsigned m = 11, t = 3;
+            Encoder<> enc(Spacer(k), canon);
+            enc.sampling(mode, m, t);
+            std::vector<u64> ref, got;
+            for(size_t p = 0; p + k <= s.size(); ++p) {
+                const u64 km = encode(p, k);
+                if(km == u64(-1)) continue;
+                const size_t r = best_mmer(p, k, m, canon) - p;
+                if(mode == Sampling::ClosedSyncmer ? (r == 0 || r == k - m): r == t)
+                    ref.push_back(canon ? canonical_representation(km, k): km);
+            }
+            enc.for_each([&](u64 x) {got.push_back(x);}, s.data(), s.size());
+            REQUIRE(ref == got);
+            REQUIRE(got.size() < s.size() / 3);
+        }
+        const unsigned w = 10, tm = 11; // tm = r + ((k - r) mod w) for r = 1
+        Encoder<> enc(Spacer(k, k + w - 1), canon);
+        enc.sampling(Sampling::ModMinimizer, tm);
+        std::vector<u64> ref, got;
+        for(size_t p = 0; p + w + k - 1 <= s.size(); ++p) {
+            if(std::any_of(&s[p], &s[p + w + k - 1], [](char c) {return c == 'N';})) continue;
+            const size_t x = best_mmer(p, w + k - 1, tm, canon) - p;
+            const u64 km = encode(p + x % w, k);
+            ref.push_back(canon ? canonical_representation(km, k): km);
+        }
+        enc.for_each([&](u64 x) {got.push_back(x);}, s.data(), s.size());
+        REQUIRE(ref == got);
+    }
+    // Ordering by a precomputed set: windows containing a member must select one.
+    const unsigned sk = 7;
+    KmerOrderSet set(sk, true);
+    for(size_t i = 0; i < 400; ++i) set.add(mt() & ((u64(1) << (2 * sk)) - 1));
+    Encoder<score::Set> senc(Spacer(sk, sk + 19), &set, true);
+    std::string clean(s);
+    for(auto &c: clean) if(c == 'N') c = 'A';
+    std::vector<u64> kms;
+    for(size_t p = 0; p + sk <= clean.size(); ++p) {
+        u64 x = 0;
+        for(size_t j = 0; j < sk; ++j) x = (x << 2) | cstr_lut[static_cast<uint8_t>(clean[p + j])];
+        kms.push_back(canonical_representation(x, sk));
+    }
+    std::vector<u64> got;
+    senc.for_each([&](u64 x) {got.push_back(x);}, clean.data(), clean.size());
+    REQUIRE(got.size() == kms.size() - 19);
+    for(size_t i = 0; i < got.size(); ++i) {
+        const bool any = std::any_of(&kms[i], &kms[i + 20], [&](u64 x) {return set.contains(x);});
+        REQUIRE(set.contains(got[i]) == any);
+    }
+}
+
+TEST_CASE("fracminhash_scaled") {
+    std::mt19937_64 mt(53);
+    std::string s(200000, 'A');
+    for(auto &c: s) c = "ACGT"[mt() % 4];
+    const double scale = 100.;
+    const u64 thresh = fmh_threshold(scale);
+    REQUIRE(fmh_threshold(1.) == u64(-1));
+    Encoder<> enc(Spacer(31), true);
+    std::vector<u64> all, got;
+    enc.for_each([&](u64 x) {all.push_back(x);}, s.data(), s.size());
+    enc.scaled(scale);
+    enc.for_each([&](u64 x) {got.push_back(x);}, s.data(), s.size());
+    std::vector<u64> ref;
+    std::copy_if(all.begin(), all.end(), std::back_inserter(ref), [&](u64 x) {return fmh_hash(x) <= thresh;});
+    REQUIRE(ref == got);
+    REQUIRE(got.size() > all.size() / 200);
+    REQUIRE(got.size() < all.size() / 50);
+    RollingHasher<uint64_t> rh(25, false);
+    all.clear(), got.clear(), ref.clear();
+    rh.for_each_hash([&](u64 x) {all.push_back(x);}, s.data(), s.size());
+    rh.scaled(scale);
+    rh.for_each_hash([&](u64 x) {got.push_back(x);}, s.data(), s.size());
+    std::copy_if(all.begin(), all.end(), std::back_inserter(ref), [&](u64 x) {return x <= thresh;});
+    REQUIRE(ref == got);
+    REQUIRE(got.size() > all.size() / 200);
+    RollingHasherSet<uint64_t> rhs(std::vector<int>{15, 21, 31});
+    std::vector<std::pair<u64, size_t>> sall, sgot, sref;
+    rhs.for_each_hash([&](u64 x, size_t hi) {sall.emplace_back(x, hi);}, s.data(), s.size());
+    rhs.scaled(scale);
+    rhs.for_each_hash([&](u64 x, size_t hi) {sgot.emplace_back(x, hi);}, s.data(), s.size());
+    std::copy_if(sall.begin(), sall.end(), std::back_inserter(sref), [&](auto x) {return x.first <= thresh;});
+    REQUIRE(sref == sgot);
+}
+
+TEST_CASE("superkmers") {
+    std::mt19937_64 mt(59);
+    std::string s(50000, 'A');
+    for(auto &c: s) c = "ACGT"[mt() % 4];
+    for(size_t i = 0; i < 30; ++i) s[mt() % s.size()] = 'N';
+    std::vector<std::pair<Spacer, bool>> configs;
+    configs.emplace_back(Spacer(21, 70), true);
+    configs.emplace_back(Spacer(21, 70), false);
+    configs.emplace_back(Spacer(13, 30), true);
+    configs.emplace_back(Spacer(11, 40, spvec_t{0, 1, 0, 0, 1, 0, 0, 0, 0, 0}), true);
+    for(const auto &cfg: configs) {
+        Encoder<> enc(cfg.first, cfg.second);
+        std::vector<u64> ref, got;
+        enc.for_each([&](u64 x) {ref.push_back(x);}, s.data(), s.size());
+        size_t nruns = 0;
+        u64 lastend = 0;
+        enc.for_each_superkmer([&](u64 x, u64 start, u64 end) {
+            REQUIRE(start < end);
+            REQUIRE(end <= s.size());
+            REQUIRE(end > lastend);
+            lastend = end;
+            got.insert(got.end(), enc.superkmer_windows(start, end), x);
+            ++nruns;
+        }, s.data(), s.size());
+        REQUIRE(ref == got);
+        REQUIRE(nruns < ref.size() / 4);
+    }
+}
+
+TEST_CASE("push_api") {
+    std::mt19937_64 mt(61);
+    std::vector<std::string> recs;
+    for(const size_t len: {20000, 30, 3, 0, 7000}) {
+        std::string s(len, 'A');
+        for(auto &c: s) c = "ACGT"[mt() % 4];
+        for(size_t i = 0; len && i < len / 500; ++i) s[mt() % len] = 'N';
+        if(len > 1000) std::fill(&s[500], &s[700], 'N');
+        recs.push_back(s);
+    }
+    auto run = [&](auto &enc, std::vector<size_t> sizes) {
+        std::vector<u64> ref, got;
+        for(const auto &s: recs) enc.for_each([&](u64 x) {ref.push_back(x);}, s.data(), s.size());
+        size_t si = 0;
+        for(const auto &s: recs) {
+            for(size_t i = 0; i < s.size();) {
+                const size_t n = std::min(sizes[si++ % sizes.size()], s.size() - i);
+                enc.feed([&](u64 x) {got.push_back(x);}, s.data() + i, n);
+                i += n;
+            }
+            enc.end_record([&](u64 x) {got.push_back(x);});
+        }
+        REQUIRE(ref == got);
+    };
+    const std::vector<std::vector<size_t>> sizes{{1}, {2, 0, 5}, {17, 31, 64}, {1000}, {1u << 20}};
+    for(const auto &sz: sizes) {
+        for(const bool canon: {true, false}) {
+            Encoder<> enc(Spacer(21, 40), canon);
+            run(enc, sz);
+            Encoder<> uw(Spacer(15), canon);
+            run(uw, sz);
+            Encoder<> sp(Spacer(9, 30, spvec_t{0, 1, 0, 0, 1, 0, 0, 0}), canon);
+            run(sp, sz);
+            Encoder<score::Entropy> ent(Spacer(13, 25), canon);
+            run(ent, sz);
+            Encoder<> prot(Spacer(6, 20), canon);
+            prot.hashtype(PROTEIN20);
+            run(prot, sz);
+            Encoder<> sync(Spacer(15), canon);
+            sync.sampling(Sampling::ClosedSyncmer, 5);
+            run(sync, sz);
+            Encoder<> modmin(Spacer(15, 40), canon);
+            modmin.sampling(Sampling::ModMinimizer, 5);
+            run(modmin, sz);
+            Encoder<> frames(Spacer(7), canon);
+            frames.hashtype(PROTEIN_6_FRAME);
+            run(frames, sz);
+        }
+    }
+    // reset discards a partially fed record.
+    Encoder<> enc(Spacer(21, 40), true);
+    std::vector<u64> ref, got;
+    enc.for_each([&](u64 x) {ref.push_back(x);}, recs[0].data(), recs[0].size());
+    enc.feed([](u64) {}, recs[4].data(), 100);
+    enc.reset();
+    enc.feed([&](u64 x) {got.push_back(x);}, recs[0].data(), recs[0].size());
+    enc.end_record([&](u64 x) {got.push_back(x);});
+    REQUIRE(ref == got);
+}
+
+TEST_CASE("fixed_k_kernels") {
+    std::mt19937_64 mt(67);
+    static const char aa[] = "ACDEFGHIKLMNPQRSTVWY";
+    std::string dna(5000, 'A'), prot(5000, 'A');
+    for(auto &c: dna) c = "ACGT"[mt() % 4];
+    for(auto &c: prot) c = aa[mt() % 20];
+    auto check = [](Encoder<> &enc, const std::string &s, bool canon) {
+        // Against kmer(), which does not roll, and the per-k-mer minimizer interface on ambiguity-free input.
+        std::vector<u64> ref, got;
+        enc.assign(s.data(), s.size());
+        for(size_t i = 0; i + enc.k() <= s.size(); ++i) {
+            u64 km = enc.kmer(i);
+            if(km != u64(-1)) ref.push_back(canon ? canonical_representation(km, enc.k()): km);
+        }
+        enc.for_each([&](u64 x) {got.push_back(x);}, s.data(), s.size());
+        REQUIRE(ref == got);
+    };
+    auto check_windowed = [](Encoder<> &enc, const std::string &s, bool canon) {
+        std::vector<u64> ref, got;
+        enc.assign(s.data(), s.size());
+        while(enc.has_next_kmer()) {
+            const u64 x = canon ? enc.next_canonicalized_minimizer(): enc.next_minimizer();
+            if(x != u64(-1)) ref.push_back(x);
+        }
+        enc.for_each([&](u64 x) {got.push_back(x);}, s.data(), s.size());
+        REQUIRE(ref == got);
+    };
+    for(const unsigned k: {15, 21, 25, 31, 17}) {
+        for(const bool canon: {true, false}) {
+            Encoder<> enc(Spacer(k), canon);
+            check(enc, dna, canon);
+            std::string withn(dna);
+            for(size_t i = 0; i < 20; ++i) withn[mt() % withn.size()] = 'N';
+            check(enc, withn, canon);
+            Encoder<> wenc(Spacer(k, k + 20), canon);
+            check_windowed(wenc, dna, canon);
+        }
+    }
+    for(const unsigned k: {7, 9, 10, 12, 11}) {
+        Encoder<> enc(Spacer(k), false);
+        enc.hashtype(PROTEIN20);
+        check(enc, prot, false);
+        Encoder<> wenc(Spacer(k, k + 10), false);
+        wenc.hashtype(PROTEIN20);
+        check_windowed(wenc, prot, false);
+    }
+}
+
+TEST_CASE("quality_masking") {
+    std::mt19937_64 mt(71);
+    std::vector<std::pair<std::string, std::string>> reads(200);
+    for(auto &r: reads) {
+        r.first.resize(150 + mt() % 30);
+        r.second.resize(r.first.size());
+        for(auto &c: r.first) c = "ACGT"[mt() % 4];
+        for(auto &q: r.second) q = static_cast<char>(33 + (mt() % 8 ? 30 + mt() % 11: mt() % 20));
+    }
+    const unsigned minq = 15;
+    for(size_t i = 0; i < 2000; ++i) {
+        const auto &r = reads[i % reads.size()];
+        const size_t off = i % 40, l = r.first.size() - off;
+        std::string out(l, 0), ref(l, 0);
+        mask_low_quality(r.first.data() + off, r.second.data() + off, l, static_cast<char>(33 + minq), 'N', &out[0]);
+        for(size_t j = 0; j < l; ++j) ref[j] = r.second[off + j] < char(33 + minq) ? 'N': r.first[off + j];
+        REQUIRE(out == ref);
+    }
+    const char *path = "test/quality_masking.tmp.fq";
+    {
+        std::ofstream ofs(path);
+        for(size_t i = 0; i < reads.size(); ++i)
+            ofs << "@read" << i << '\n' << reads[i].first << "\n+\n" << reads[i].second << '\n';
+    }
+    std::vector<std::string> masked;
+    for(const auto &r: reads) {
+        std::string m(r.first);
+        for(size_t j = 0; j < m.size(); ++j) if(r.second[j] < char(33 + minq)) m[j] = 'N';
+        masked.push_back(m);
+    }
+    for(const bool canon: {true, false}) {
+        Encoder<> enc(Spacer(21, 30), canon);
+        std::vector<u64> ref, got, all;
+        for(const auto &m: masked) enc.for_each([&](u64 x) {ref.push_back(x);}, m.data(), m.size());
+        enc.for_each([&](u64 x) {all.push_back(x);}, path);
+        enc.min_quality(minq);
+        REQUIRE(enc.min_quality() == minq);
+        enc.for_each([&](u64 x) {got.push_back(x);}, path);
+        REQUIRE(ref == got);
+        REQUIRE(got.size() < all.size());
+        RollingHasher<uint64_t> rh(21, canon);
+        std::vector<u64> href, hgot;
+        for(const auto &m: masked) rh.for_each_hash([&](u64 x) {href.push_back(x);}, m.data(), m.size());
+        rh.min_quality(minq);
+        rh.for_each_hash([&](u64 x) {hgot.push_back(x);}, path);
+        REQUIRE(href.size() == hgot.size());
+        REQUIRE(href == hgot);
+    }
+    std::remove(path);
+}
+
+TEST_CASE("dust_masking") {
+    std::mt19937_64 mt(73);
+    std::string s(60000, 'A');
+    for(auto &c: s) c = "ACGT"[mt() % 4];
+    for(size_t i = 0; i < 40; ++i) {
+        // Poly-A, dinucleotide and pentanucleotide repeats, and a few N
+        const size_t start = mt() % (s.size() - 200), len = 30 + mt() % 150;
+        static const char *units[] = {"A", "CA", "GATTA", "N"};
+        const char *u = units[i % 4];
+        for(size_t j = 0; j < (i % 4 == 3 ? 3: len); ++j) s[start + j] = u[j % std::strlen(u)];
+    }
+    const unsigned k = 21, w = 64, level = 20;
+    std::vector<bool> masked(s.size(), false); // By k-mer end
+    for(size_t e = 0, last = 0; e < s.size(); ++e) {
+        if(s[e] == 'N') {last = e + 1; continue;}
+        const size_t ws = std::max(last, e + 1 >= w ? e + 1 - w: size_t(0));
+        unsigned counts[64]{};
+        uint64_t r = 0, n = 0;
+        for(size_t j = ws + 2; j <= e; ++j) {
+            const unsigned t = (cstr_lut[uint8_t(s[j - 2])] << 4) | (cstr_lut[uint8_t(s[j - 1])] << 2) | cstr_lut[uint8_t(s[j])];
+            r += counts[t]++;
+            ++n;
+        }
+        masked[e] = r * 10 > uint64_t(level) * n;
+    }
+    for(const bool canon: {true, false}) {
+        Encoder<> plain(Spacer(k), canon), enc(Spacer(k), canon);
+        enc.dust(level, w);
+        REQUIRE(enc.dust_level() == level);
+        std::vector<u64> ref, got;
+        size_t total = 0;
+        plain.for_each([&](u64 x) {++total; if(!masked[plain.pos() - 1]) ref.push_back(x);}, s.data(), s.size());
+        enc.for_each([&](u64 x) {got.push_back(x);}, s.data(), s.size());
+        REQUIRE(ref == got);
+        REQUIRE(got.size() + 1000 < total);
+        // Windowed: masked k-mers are never selected, and chunked/pushed encodings agree with serial.
+        Encoder<> wenc(Spacer(k, k + 30), canon);
+        wenc.dust(level, w);
+        std::vector<u64> wgot, pgot, fgot;
+        wenc.for_each([&](u64 x) {wgot.push_back(x);}, s.data(), s.size());
+        std::sort(ref.begin(), ref.end());
+        REQUIRE(std::all_of(wgot.begin(), wgot.end(), [&](u64 x) {return std::binary_search(ref.begin(), ref.end(), x);}));
+        wenc.for_each_parallel([&](u64 x) {pgot.push_back(x);}, s.data(), s.size(), 4, 5000);
+        REQUIRE(wgot == pgot);
+        for(size_t i = 0; i < s.size(); i += 999) wenc.feed([&](u64 x) {fgot.push_back(x);}, s.data() + i, std::min<size_t>(999, s.size() - i));
+        wenc.end_record([&](u64 x) {fgot.push_back(x);});
+        REQUIRE(wgot == fgot);
+    }
+}
+
+TEST_CASE("lane_hashing") {
+    std::mt19937_64 mt(97);
+    std::vector<std::string> seqs(301), quals(seqs.size()), prots(seqs.size());
+    for(size_t i = 0; i < seqs.size(); ++i) {
+        auto &s = seqs[i];
+        s.resize(mt() % 320);
+        for(auto &c: s) c = "ACGTacgt"[mt() % (i % 3 ? 4: 8)];
+        if(i % 4 == 0 && s.size() > 40) std::fill_n(&s[mt() % (s.size() - 20)], 1 + mt() % 15, 'N');
+        quals[i].resize(s.size());
+        for(auto &q: quals[i]) q = static_cast<char>(33 + (mt() % 16 ? 30: mt() % 20));
+        prots[i].resize(s.size());
+        for(auto &c: prots[i]) c = "ACDEFGHIKLMNPQRSTVWY"[mt() % 20];
+    }
+    auto ptrs = [](const std::vector<std::string> &v) {
+        std::vector<const char *> ret;
+        for(const auto &s: v) ret.push_back(s.data());
+        return ret;
+    };
+    std::vector<size_t> lens;
+    for(const auto &s: seqs) lens.push_back(s.size());
+    const auto sp = ptrs(seqs), qp = ptrs(quals), pp = ptrs(prots);
+    auto check = [&](RollingHasher<uint64_t> &rh, const std::vector<std::string> &v, const std::vector<const char *> &p, const char *const *q) {
+        std::vector<std::vector<u64>> ref(v.size()), got(v.size());
+        for(size_t i = 0; i < v.size(); ++i) {
+            std::string m(v[i]);
+            if(q && rh.min_quality())
+                for(size_t j = 0; j < m.size(); ++j) if(q[i][j] < char(33 + rh.min_quality())) m[j] = 'N';
+            rh.for_each_hash([&](u64 x) {ref[i].push_back(x);}, m.data(), m.size());
+        }
+        rh.for_each_hash_lanes([&](size_t i, u64 x) {got[i].push_back(x);}, v.size(), p.data(), lens.data(), q);
+        REQUIRE(ref == got);
+        return std::accumulate(got.begin(), got.end(), size_t(0), [](size_t n, const auto &x) {return n + x.size();});
+    };
+    for(const unsigned k: {15u, 31u, 70u}) {
+        for(const bool canon: {true, false}) {
+            for(const int w: {-1, 50, 120}) {
+                RollingHasher<uint64_t> rh(k, canon, DNA, w);
+                REQUIRE(check(rh, seqs, sp, nullptr) > 0);
+                rh.min_quality(20);
+                check(rh, seqs, sp, qp.data());
+                rh.scaled(4.);
+                check(rh, seqs, sp, qp.data());
+            }
+            RollingHasher<uint64_t> prh(k / 3, false, PROTEIN, canon ? -1: 40);
+            REQUIRE(check(prh, prots, pp, nullptr) > 0);
+        }
+    }
+    for(const char *path: {"test/phix.fa", "test/small_genome.fa"}) {
+        RollingHasher<uint64_t> rh(15, true, DNA, 30);
+        std::vector<u64> ref, got;
+        rh.for_each_hash([&](u64 x) {ref.push_back(x);}, path);
+        rh.for_each_hash_lanes([&](size_t, u64 x) {got.push_back(x);}, path);
+        std::sort(ref.begin(), ref.end());
+        std::sort(got.begin(), got.end());
+        REQUIRE(ref == got);
+    }
+}
+
+TEST_CASE("nthash_multik") {
+    std::mt19937_64 mt(211);
+    std::string s(5000, 0);
+    for(auto &c: s) c = "ACGTacgt"[mt() % 8];
+    for(size_t i = 0; i < 10; ++i) std::fill_n(&s[mt() % (s.size() - 50)], 1 + mt() % 20, 'N');
+    const std::vector<int> ks{31, 9, 21, 64, 15, 100, 21};
+    auto rol = [](u64 x, unsigned r) {r &= 63; return r ? (x << r) | (x >> (64 - r)): x;};
+    auto seed = [](char c, bool rc) {
+        const u64 acgt[4] {seedA, seedC, seedG, seedT};
+        const int v = cstr_lut[uint8_t(c)];
+        return acgt[rc ? 3 - v: v];
+    };
+    std::vector<size_t> order(ks.size());
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::stable_sort(order.begin(), order.end(), [&](size_t x, size_t y) {return ks[x] < ks[y];});
+    for(const bool canon: {true, false}) {
+        std::vector<std::pair<u64, size_t>> ref, got;
+        for(size_t e = 0; e < s.size(); ++e) {
+            for(const size_t hi: order) {
+                const size_t k = ks[hi];
+                if(e + 1 < k) continue;
+                const size_t a = e + 1 - k;
+                if(std::any_of(&s[a], &s[e + 1], [](char c) {return cstr_lut[uint8_t(c)] < 0;})) continue;
+                if(k <= 64) { // ntHash's own functions
+                    ref.emplace_back(canon ? NTC64(&s[a], k): NTF64(&s[a], k), hi);
+                    continue;
+                }
+                u64 f = 0, r = 0;
+                for(size_t p = a; p <= e; ++p) f ^= rol(seed(s[p], false), e - p), r ^= rol(seed(s[p], true), p - a);
+                ref.emplace_back(canon ? std::min(f, r): f, hi);
+            }
+        }
+        NtHashSet nhs(ks, canon);
+        REQUIRE(nhs.get_mink() == 9u);
+        nhs.for_each_hash([&](u64 x, size_t hi) {got.emplace_back(x, hi);}, s.data(), s.size());
+        REQUIRE(got == ref);
+        std::vector<std::vector<u64>> batched(ks.size()), perk(ks.size());
+        for(const auto &p: got) perk[p.second].push_back(p.first);
+        nhs.for_each_batch([&](KmerSpan<u64> sp, size_t hi) {batched[hi].insert(batched[hi].end(), sp.begin(), sp.end());}, s.data(), s.size());
+        REQUIRE(batched == perk);
+        if(canon) {
+            // Canonical values don't depend on the strand.
+            std::string rc(s.rbegin(), s.rend());
+            for(auto &c: rc) c = cstr_lut[uint8_t(c)] < 0 ? 'N': "TGCA"[cstr_lut[uint8_t(c)]];
+            std::vector<std::vector<u64>> rcperk(ks.size());
+            nhs.for_each_hash([&](u64 x, size_t hi) {rcperk[hi].push_back(x);}, rc.data(), rc.size());
+            for(size_t hi = 0; hi < ks.size(); ++hi) {
+                std::sort(rcperk[hi].begin(), rcperk[hi].end());
+                std::sort(perk[hi].begin(), perk[hi].end());
+                REQUIRE(rcperk[hi] == perk[hi]);
+            }
+        }
+        nhs.scaled(8.);
+        std::vector<std::pair<u64, size_t>> sgot;
+        nhs.for_each_hash([&](u64 x, size_t hi) {sgot.emplace_back(x, hi);}, s.data(), s.size());
+        std::vector<std::pair<u64, size_t>> sref;
+        std::copy_if(ref.begin(), ref.end(), std::back_inserter(sref), [&](const auto &p) {return p.first <= nhs.scaled_threshold();});
+        REQUIRE(sgot == sref);
+        REQUIRE(sgot.size() < ref.size());
+    }
+}
+
+TEST_CASE("homopolymer_compression") {
+    std::mt19937_64 mt(97);
+    std::string s;
+    while(s.size() < 30000) {
+        const uint64_t r = mt();
+        if(r % 97 == 0) s.append(1 + r / 97 % 5, "NNRn"[r / 1000 % 4]);
+        else s.append(1 + r / 97 % 6, "ACGTacgt"[r / 1000 % 8]);
+    }
+    // Reference: runs of one base or of ambiguous characters collapse to a single character.
+    auto compress = [](const std::string &x) {
+        std::string ret;
+        int last = -2;
+        for(const char c: x) {
+            const int v = cstr_lut[uint8_t(c)];
+            if(v != last) ret.push_back(v < 0 ? 'N': "ACGT"[v]);
+            last = v;
+        }
+        return ret;
+    };
+    const std::string hs = compress(s);
+    REQUIRE(hs.size() < s.size() / 2);
+    // Changing run lengths leaves the compressed sequence, and so the k-mers, unchanged.
+    std::string noisy;
+    for(size_t i = 0; i < s.size(); ++i) noisy.append(cstr_lut[uint8_t(s[i])] >= 0 && mt() % 8 == 0 ? 2: 1, s[i]);
+    REQUIRE(compress(noisy) == hs);
+    for(const bool canon: {true, false}) {
+        for(const unsigned w: {0u, 40u}) {
+            Encoder<> plain(w ? Spacer(21, w): Spacer(21), canon), enc(plain);
+            enc.homopolymer_compress(true);
+            REQUIRE(enc.homopolymer_compress());
+            REQUIRE(!enc.streamable());
+            REQUIRE(!enc.parallelizable());
+            std::vector<u64> ref, got, ngot, fgot;
+            plain.for_each([&](u64 x) {ref.push_back(x);}, hs.data(), hs.size());
+            enc.for_each([&](u64 x) {got.push_back(x);}, s.data(), s.size());
+            REQUIRE(ref.size() > 1000);
+            REQUIRE(got == ref);
+            enc.for_each([&](u64 x) {ngot.push_back(x);}, noisy.data(), noisy.size());
+            REQUIRE(ngot == ref);
+            for(size_t i = 0; i < s.size(); i += 777) enc.feed([&](u64 x) {fgot.push_back(x);}, s.data() + i, std::min<size_t>(777, s.size() - i));
+            enc.end_record([&](u64 x) {fgot.push_back(x);});
+            REQUIRE(fgot == ref);
+            // With DUST masking, scores are taken over the compressed sequence as well.
+            plain.dust(20, 64); enc.dust(20, 64);
+            ref.clear(); got.clear();
+            plain.for_each([&](u64 x) {ref.push_back(x);}, hs.data(), hs.size());
+            enc.for_each([&](u64 x) {got.push_back(x);}, s.data(), s.size());
+            REQUIRE(got == ref);
+        }
+        for(const int w: {-1, 50}) {
+            RollingHasher<uint64_t> plain(21, canon, DNA, w), rh(21, canon, DNA, w);
+            rh.homopolymer_compress(true);
+            std::vector<uint64_t> ref, got, ngot;
+            plain.for_each_hash([&](uint64_t x) {ref.push_back(x);}, hs.data(), hs.size());
+            rh.for_each_hash([&](uint64_t x) {got.push_back(x);}, s.data(), s.size());
+            rh.for_each_hash([&](uint64_t x) {ngot.push_back(x);}, noisy.data(), noisy.size());
+            REQUIRE(ref.size() > 1000);
+            REQUIRE(got == ref);
+            REQUIRE(ngot == ref);
+            const char *seqs[] {s.data(), noisy.data()};
+            const size_t lens[] {s.size(), noisy.size()};
+            std::vector<uint64_t> lanes[2];
+            rh.for_each_hash_lanes([&](size_t i, uint64_t x) {lanes[i].push_back(x);}, 2, seqs, lens);
+            REQUIRE(lanes[0] == ref);
+            REQUIRE(lanes[1] == ref);
+        }
+    }
+}
+
+TEST_CASE("kmer_positions") {
+    std::mt19937_64 mt(1009);
+    std::string s(20000, 0);
+    for(auto &c: s) c = "ACGTacgt"[mt() % 8];
+    for(size_t i = 0; i < 30; ++i) std::fill_n(&s[mt() % (s.size() - 40)], 1 + mt() % 30, 'A');
+    for(size_t i = 0; i < 10; ++i) std::fill_n(&s[mt() % (s.size() - 40)], 1 + mt() % 5, 'N');
+    const unsigned k = 21;
+    // Forward and reverse-complement 2-bit encodings of the k bases (or base runs, if hpc) starting at start
+    auto encode_at = [&](size_t start, bool hpc, bool rc) {
+        u64 f = 0, r = 0;
+        int last = -1;
+        unsigned n = 0;
+        for(size_t i = start; n < k; ++i) {
+            const int v = cstr_lut[uint8_t(s.at(i))];
+            REQUIRE(v >= 0);
+            if(hpc && v == last) continue;
+            last = v;
+            f = (f << 2) | v;
+            r |= u64(3 - v) << (2 * n++);
+        }
+        return rc ? r: f;
+    };
+    for(const bool canon: {true, false}) {
+        for(const bool hpc: {false, true}) {
+            for(const unsigned w: {0u, 40u}) {
+                Encoder<> enc(w ? Spacer(k, w): Spacer(k), canon);
+                enc.homopolymer_compress(hpc);
+                std::vector<u64> ref, got;
+                enc.for_each([&](u64 x) {ref.push_back(x);}, s.data(), s.size());
+                size_t nrc = 0;
+                enc.for_each_with_pos([&](u64 x, u64 start, bool rc) {
+                    got.push_back(x);
+                    nrc += rc;
+                    REQUIRE(x == encode_at(start, hpc, rc));
+                    if(hpc && start) REQUIRE(cstr_lut[uint8_t(s[start - 1])] != cstr_lut[uint8_t(s[start])]);
+                }, s.data(), s.size());
+                REQUIRE(got == ref);
+                REQUIRE(canon == (nrc > 0));
+                enc.scaled(4.);
+                ref.clear(); got.clear();
+                enc.for_each([&](u64 x) {ref.push_back(x);}, s.data(), s.size());
+                enc.for_each_with_pos([&](u64 x, u64, bool) {got.push_back(x);}, s.data(), s.size());
+                REQUIRE(got == ref);
+            }
+        }
+    }
+    // Other unwindowed configurations take positions from pos().
+    for(const RollingHashType rht: {DNA, PROTEIN20}) {
+        Spacer sp(k / 3, 0, spvec_t{0, 2, 0, 1, 0, 0});
+        Encoder<> enc(rht == DNA ? sp: Spacer(k / 3), false), check(enc);
+        enc.hashtype(rht); check.hashtype(rht);
+        check.assign(s.data(), s.size());
+        size_t n = 0;
+        enc.for_each_with_pos([&](u64 x, u64 start, bool rc) {
+            REQUIRE(!rc);
+            REQUIRE(check.kmer(start) == x);
+            ++n;
+        }, s.data(), s.size());
+        REQUIRE(n > 10000);
+    }
+    // Canonical and windowed spaced seeds, as used by GenomeChunker, emit what for_each does, at starts within s.
+    for(const unsigned w: {0u, 40u}) {
+        Encoder<> enc(Spacer(k / 3, w, spvec_t{0, 2, 0, 1, 0, 0}), true);
+        std::vector<u64> ref, got;
+        enc.for_each([&](u64 x) {ref.push_back(x);}, s.data(), s.size());
+        enc.for_each_with_pos([&](u64 x, u64 start, bool) {
+            REQUIRE(start < s.size());
+            got.push_back(x);
+        }, s.data(), s.size());
+        REQUIRE(ref.size() > 1000);
+        REQUIRE(got == ref);
+    }
+    for(const bool canon: {true, false}) {
+        for(const bool hpc: {false, true}) {
+            for(const int w: {-1, 50}) {
+                RollingHasher<uint64_t> rh(k, canon, DNA, w), fwd(k, false, DNA), both(k, true, DNA);
+                rh.homopolymer_compress(hpc);
+                fwd.homopolymer_compress(hpc); both.homopolymer_compress(hpc);
+                std::vector<uint64_t> ref, got;
+                rh.for_each_hash([&](uint64_t x) {ref.push_back(x);}, s.data(), s.size());
+                rh.for_each_with_pos([&](uint64_t x, u64 start, bool rc) {
+                    got.push_back(x);
+                    // The hashes of the k-mer at start on either strand
+                    uint64_t fh = 0, ch = 0;
+                    size_t end = start;
+                    for(unsigned n = 0; n < k; ++end) n += !hpc || end == start || cstr_lut[uint8_t(s[end])] != cstr_lut[uint8_t(s[end - 1])];
+                    fwd.for_each_hash([&](uint64_t y) {fh = y;}, &s[start], end - start);
+                    both.for_each_hash([&](uint64_t y) {ch = y;}, &s[start], end - start);
+                    REQUIRE(rc == (x != fh));
+                    REQUIRE((!canon || w > 0 || x == ch));
+                    REQUIRE((canon || !rc));
+                }, s.data(), s.size());
+                REQUIRE(got == ref);
+            }
+        }
+    }
+}
+
+TEST_CASE("decompressing_reader") {
+    const unsigned char gzm[] = {0x1f, 0x8b, 8, 0}, zsm[] = {0x28, 0xb5, 0x2f, 0xfd}, xzm[] = {0xfd, '7', 'z', 'X', 'Z', 0}, bzm[] = {'B', 'Z', 'h', '9'};
+    REQUIRE(detect_compression(gzm, 4) == CompressionFormat::GZIP);
+    REQUIRE(detect_compression(zsm, 4) == CompressionFormat::ZSTD);
+    REQUIRE(detect_compression(xzm, 6) == CompressionFormat::XZ);
+    REQUIRE(detect_compression(bzm, 4) == CompressionFormat::BZIP2);
+    REQUIRE(detect_compression(reinterpret_cast<const unsigned char *>(">seq"), 4) == CompressionFormat::NONE);
+    std::string text;
+    {
+        std::ifstream ifs("test/phix.fa");
+        text.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    }
+    // Two gzip members, as written by bgzip or by concatenating gzip files; the name does not say what the file is.
+    const char *gzpath = "test/decompress.tmp.fa";
+    for(const size_t half: {size_t(0), text.size() / 2}) {
+        gzFile fp = gzopen(gzpath, half ? "ab": "wb");
+        const size_t end = half ? text.size(): text.size() / 2;
+        gzwrite(fp, text.data() + half, end - half);
+        gzclose(fp);
+    }
+    Encoder<> enc(Spacer(21, 30), true);
+    std::vector<u64> ref, got;
+    enc.for_each([&](u64 x) {ref.push_back(x);}, "test/phix.fa");
+    enc.for_each([&](u64 x) {got.push_back(x);}, gzpath);
+    REQUIRE(ref.size() > 0);
+    REQUIRE(ref == got);
+    {
+        DecompressingReader reader(gzpath);
+        REQUIRE(reader.format() == CompressionFormat::GZIP);
+        std::FILE *fp = reader.file();
+        std::string out;
+        char buf[4096];
+        for(size_t n; (n = std::fread(buf, 1, sizeof(buf), fp));) out.append(buf, n);
+        std::fclose(fp);
+        REQUIRE(out == text);
+    }
+    {
+        // Closing the handle early stops the decompressing thread, even once all of the input has been read
+        // and more output remains than the pipe holds.
+        const char *bigpath = "test/decompress.tmp.big.gz";
+        gzFile ofp = gzopen(bigpath, "wb");
+        for(size_t i = 0; i < 16 << 20; i += text.size()) gzwrite(ofp, text.data(), text.size());
+        gzclose(ofp);
+        DecompressingReader reader(bigpath);
+        std::FILE *fp = reader.file();
+        REQUIRE(std::fgetc(fp) == '>');
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        std::fclose(fp);
+        std::remove(bigpath);
+    }
+    {
+        // Input which cannot seek, such as a FIFO or /dev/stdin, is only read once.
+        const char *fifo = "test/decompress.tmp.fifo";
+        for(const char *src: {"test/phix.fa", gzpath}) {
+            std::remove(fifo);
+            REQUIRE(::mkfifo(fifo, 0600) == 0);
+            std::thread writer([&]() {
+                std::FILE *in = std::fopen(src, "rb"), *out = std::fopen(fifo, "wb");
+                char buf[4096];
+                for(size_t n; (n = std::fread(buf, 1, sizeof(buf), in));) std::fwrite(buf, 1, n, out);
+                std::fclose(in); std::fclose(out);
+            });
+            got.clear();
+            enc.for_each([&](u64 x) {got.push_back(x);}, fifo);
+            writer.join();
+            REQUIRE(ref == got);
+        }
+        std::remove(fifo);
+    }
+    // xz, bzip2 and zstd files, if their tools are installed to write them.
+    const std::pair<const char *, CompressionFormat> tools[] {
+        {"xz", CompressionFormat::XZ}, {"bzip2", CompressionFormat::BZIP2}, {"zstd", CompressionFormat::ZSTD}
+    };
+    for(const auto &tool: tools) {
+        const std::string path = std::string("test/decompress.tmp.") + tool.first;
+        if(std::system((std::string(tool.first) + " -c test/phix.fa > " + path + " 2>/dev/null").data())) {
+            std::remove(path.data());
+            continue;
+        }
+        REQUIRE(DecompressingReader(path).format() == tool.second);
+        got.clear();
+        enc.for_each([&](u64 x) {got.push_back(x);}, path.data());
+        REQUIRE(ref == got);
+        RollingHasher<uint64_t> rh(21, true);
+        std::vector<u64> href, hgot;
+        rh.for_each_hash([&](u64 x) {href.push_back(x);}, "test/phix.fa");
+        rh.for_each_hash([&](u64 x) {hgot.push_back(x);}, path.data());
+        REQUIRE(href == hgot);
+        std::remove(path.data());
+    }
+    std::remove(gzpath);
+}
+
+TEST_CASE("read_ahead") {
+    auto read_all = [](gzFile fp, size_t bufsize, bool enable) {
+        std::vector<std::string> ret;
+        ReadAhead ra(fp, enable, bufsize);
+        REQUIRE(ra.active() == enable);
+        kseq_t *ks = kseq_init(fp);
+        while(kseq_read(ks) >= 0) ret.emplace_back(std::string(ks->name.s) + ':' + ks->seq.s);
+        kseq_destroy(ks);
+        return ret;
+    };
+    const char *path = "test/read_ahead.tmp.fa.gz";
+    {
+        std::mt19937_64 mt(25);
+        gzFile fp = gzopen(path, "wb");
+        for(size_t i = 0; i < 500; ++i) {
+            std::string seq(mt() % 2000 + 1, 'A');
+            for(auto &c: seq) c = "ACGTN"[mt() % 5];
+            gzprintf(fp, ">seq%zu\n%s\n", i, seq.data());
+        }
+        gzclose(fp);
+    }
+    gzFile fp = gzopen(path, "rb");
+    const auto ref = read_all(fp, 0, false);
+    gzclose(fp);
+    REQUIRE(ref.size() == 500);
+    // Buffers smaller than kseq's exercise every hand-off; larger ones are the common case.
+    for(const size_t bufsize: {size_t(1), size_t(1) << 16, ReadAhead::DEFAULT_BUFSIZE}) {
+        fp = gzopen(path, "rb");
+        REQUIRE(read_all(fp, bufsize, true) == ref);
+        gzclose(fp);
+    }
+    {
+        // Two files read ahead at once, read alternately
+        gzFile fp1 = gzopen(path, "rb"), fp2 = gzopen("test/phix.fa", "rb");
+        ReadAhead ra1(fp1, true, 4096), ra2(fp2, true, 4096);
+        kseq_t *ks1 = kseq_init(fp1), *ks2 = kseq_init(fp2);
+        size_t n1 = 0, n2 = 0;
+        for(bool more1 = true, more2 = true; more1 || more2;) {
+            if(more1 && (more1 = kseq_read(ks1) >= 0)) REQUIRE(std::string(ks1->name.s) + ':' + ks1->seq.s == ref[n1++]);
+            if(more2 && (more2 = kseq_read(ks2) >= 0)) ++n2;
+        }
+        REQUIRE(n1 == ref.size());
+        REQUIRE(n2 == 1);
+        kseq_destroy(ks1); kseq_destroy(ks2);
+        // Stopping early, with data still read ahead
+        ra1.stop(); ra2.stop();
+        gzclose(fp1); gzclose(fp2);
+    }
+    Encoder<> enc(Spacer(21, 30), true);
+    std::vector<u64> got, all;
+    for(const auto &r: ref) {
+        const auto seq = r.substr(r.find(':') + 1);
+        enc.for_each([&](u64 x) {all.push_back(x);}, seq.data(), seq.size());
+    }
+    enc.for_each([&](u64 x) {got.push_back(x);}, path);
+    REQUIRE(all == got);
+    std::remove(path);
+}
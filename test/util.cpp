@@ -1,5 +1,7 @@
 #include "test/catch.hpp"
 #include "util.h"
+#include "database.h"
+#include <fstream>
 using namespace bns;
 
 #define is_pow2(x) ((x & (x - 1)) == 0)
@@ -41,3 +43,45 @@ TEST_CASE("roundup64") {
         REQUIRE(__builtin_clzll(d) - 1 == __builtin_clzll(roundup64(d)));
     }
 }
+
+TEST_CASE("database_format_version") {
+    const char *path = "__dbver__";
+    khash_t(c) *h(kh_init(c));
+    int khr;
+    for(u64 i(0); i < 64; ++i) kh_val(h, kh_put(c, h, i * 7919, &khr)) = i;
+    Database<khash_t(c)> out(Spacer(31), 0, h);
+    out.write(path);
+    {
+        Database<khash_t(c)> db(path);
+        REQUIRE(db.version_ == DB_VERSION);
+        REQUIRE(db.alphabet_ == DNA);
+        REQUIRE(db.k_ == 31);
+        REQUIRE(kh_size(db.db_) == kh_size(h));
+    }
+    // Files from before the header are read as version 1 DNA databases.
+    std::string bytes;
+    {
+        std::ifstream ifs(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    }
+    std::ofstream(path, std::ios::binary).write(bytes.data() + 3 * sizeof(uint32_t), bytes.size() - 3 * sizeof(uint32_t));
+    {
+        Database<khash_t(c)> db(path);
+        REQUIRE(db.version_ == 1);
+        REQUIRE(db.k_ == 31);
+        REQUIRE(kh_size(db.db_) == kh_size(h));
+    }
+    // PROTEIN20 k-mers written in the version 1 encoding are refused.
+    out.alphabet_ = PROTEIN20;
+    out.write(path);
+    {
+        std::FILE *fp(std::fopen(path, "r+b"));
+        const uint32_t version(1);
+        std::fseek(fp, sizeof(uint32_t), SEEK_SET);
+        std::fwrite(&version, sizeof(version), 1, fp);
+        std::fclose(fp);
+    }
+    REQUIRE_THROWS(Database<khash_t(c)>(path));
+    std::remove(path);
+    kh_destroy(c, h);
+}